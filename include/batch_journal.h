@@ -0,0 +1,50 @@
+// include/batch_journal.h
+#ifndef BATCH_JOURNAL_H
+#define BATCH_JOURNAL_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Append-only record of a batch run, kept next to the manifest as
+// <manifest>.journal. One line per record:
+//   M <fingerprint>            manifest the journal belongs to
+//   S <index> <dest>           entry started, with its resolved destination
+//   P <index> <offset> <file>  bytes of file durably copied so far
+//   D <index>                  entry finished
+// Records are fsynced, so after a crash every D and P line is trustworthy.
+
+typedef struct {
+    FILE* file;
+    char path[MAX_PATH_LENGTH];
+    size_t op_count;
+    unsigned char* done;
+    char** dest;                // per entry, NULL until started
+    char** partial_file;        // per entry, last file with a P record
+    uint64_t* partial_offset;
+} batch_journal_t;
+
+// Open the journal for a manifest with op_count entries. With resume set,
+// an existing journal is replayed (and must match the manifest);
+// otherwise any old journal is discarded.
+int batch_journal_open(batch_journal_t* journal, const char* manifest_path,
+                       const char* manifest, size_t op_count, int resume);
+
+// Close the journal; it is deleted when the whole batch completed
+void batch_journal_close(batch_journal_t* journal, int completed);
+
+int batch_journal_started(batch_journal_t* journal, size_t index,
+                          const char* dest);
+int batch_journal_progress(batch_journal_t* journal, size_t index,
+                           uint64_t offset, const char* file);
+int batch_journal_done(batch_journal_t* journal, size_t index);
+
+int batch_journal_is_done(const batch_journal_t* journal, size_t index);
+
+// Destination recorded for a started entry, or NULL
+const char* batch_journal_dest(const batch_journal_t* journal, size_t index);
+
+// Last checkpointed offset of file within entry index; 0 if none
+uint64_t batch_journal_offset(const batch_journal_t* journal, size_t index,
+                              const char* file);
+
+#endif // BATCH_JOURNAL_H
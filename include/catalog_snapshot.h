@@ -0,0 +1,79 @@
+// include/catalog_snapshot.h
+#ifndef CATALOG_SNAPSHOT_H
+#define CATALOG_SNAPSHOT_H
+
+#include "common.h"
+#include <stdint.h>
+
+// Read-only, memory-mappable copy of the active catalog. Layout:
+//   header | records sorted by (parent_id, name) | path hash index | strings
+// Strings are NUL-terminated, so lookups hand out pointers into the mapping
+// and nothing is parsed or copied at open time.
+
+#define CATALOG_SNAPSHOT_MAGIC   "FMSNAP1"
+#define CATALOG_SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_TYPE_FILE      0
+#define SNAPSHOT_TYPE_DIRECTORY 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_count;
+    uint64_t records_offset;
+    uint64_t index_offset;
+    uint64_t index_slots;       // power of two; slot = record index + 1
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    int64_t created_at;
+} snapshot_header_t;
+
+typedef struct {
+    int64_t id;
+    int64_t parent_id;          // 0 for top-level entries
+    uint64_t size;
+    uint64_t chunk_size;
+    int64_t created_at;
+    int64_t modified_at;
+    uint64_t path_hash;
+    uint32_t name;              // offsets into the string table
+    uint32_t path;
+    uint32_t checksum;
+    uint32_t checksum_algo;
+    uint8_t type;
+    uint8_t reserved[7];
+} snapshot_record_t;
+
+typedef struct {
+    void* base;
+    size_t length;
+    const snapshot_header_t* header;
+    const snapshot_record_t* records;
+    const uint32_t* index;
+    const char* strings;
+} catalog_snapshot_t;
+
+// Write the active catalog to path (atomically replacing it)
+int catalog_snapshot_export(const char* path);
+
+// Map a snapshot; only the header is validated
+int catalog_snapshot_open(const char* path, catalog_snapshot_t* snap);
+void catalog_snapshot_close(catalog_snapshot_t* snap);
+
+// NULL if path is not in the snapshot
+const snapshot_record_t* catalog_snapshot_lookup(const catalog_snapshot_t* snap,
+                                                 const char* path);
+
+// Children of dir_path ("" or "/" for the top level) are contiguous;
+// returns their count and points *first at the first one
+size_t catalog_snapshot_list(const catalog_snapshot_t* snap,
+                             const char* dir_path,
+                             const snapshot_record_t** first);
+
+static inline const char* catalog_snapshot_string(const catalog_snapshot_t* snap,
+                                                  uint32_t offset) {
+    return snap->strings + offset;
+}
+
+#endif // CATALOG_SNAPSHOT_H
@@ -0,0 +1,59 @@
+// include/checksum.h
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "common.h"
+
+// In stores with chunked checksums, files at least this large are hashed
+// in independent chunks
+#define CHECKSUM_CHUNKED_MIN_SIZE (64 * 1024 * 1024)
+#define CHECKSUM_CHUNK_SIZE       (16 * 1024 * 1024)
+
+// Upper bound on hashing threads for one file
+#define CHECKSUM_MAX_THREADS 16
+
+// Hash algorithms a store can use. BLAKE3 and xxHash3 are only available
+// when built with FM_HAVE_BLAKE3 / FM_HAVE_XXHASH. xxHash3 is not
+// cryptographic and only suited to change detection.
+typedef enum {
+    CHECKSUM_SHA256,
+    CHECKSUM_BLAKE3,
+    CHECKSUM_XXH3,
+} checksum_algo_t;
+
+#define CHECKSUM_DEFAULT_ALGO CHECKSUM_SHA256
+
+// Map catalog algorithm tags to checksum_algo_t. An empty tag is a row
+// written before tags existed and means SHA-256. Fails for unknown tags
+// and for algorithms this build does not include.
+int checksum_algo_from_name(const char* name, checksum_algo_t* algo);
+const char* checksum_algo_name(checksum_algo_t algo);
+
+// Flat hash over the whole file
+int checksum_file(const char* path, checksum_algo_t algo, char* checksum);
+
+// Hash every chunk of the file in parallel; root is the Merkle root
+// over the chunk hashes
+int checksum_file_chunked(const char* path, checksum_algo_t algo,
+                          size_t chunk_size, chunk_list_t* chunks, char* root);
+
+// Rehash only the chunks flagged in dirty (one byte per chunk of the
+// current file; chunks past the old end are always rehashed), then
+// recompute root. chunks is resized to the current file length.
+int checksum_rehash_chunks(const char* path, checksum_algo_t algo,
+                           chunk_list_t* chunks, const unsigned char* dirty,
+                           char* root);
+
+// Rehash all chunks and report the indexes whose hash no longer matches.
+// *bad is allocated by the callee and must be freed by the caller.
+int checksum_verify_chunks(const char* path, checksum_algo_t algo,
+                           const chunk_list_t* chunks, size_t** bad,
+                           size_t* bad_count);
+
+// Merkle root over the chunk hashes
+void checksum_merkle_root(checksum_algo_t algo, const chunk_list_t* chunks,
+                          char* root);
+
+void checksum_free_chunks(chunk_list_t* chunks);
+
+#endif // CHECKSUM_H
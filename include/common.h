@@ -42,8 +42,10 @@ typedef struct {
     time_t created_at;
     time_t modified_at;
     int parent_id;
-    char checksum[65];  // SHA-256 hash (64 chars + null terminator)
+    char checksum[65];  // hex digest (up to 64 chars + null terminator)
+    char checksum_algo[16];  // algorithm tag, e.g. "sha256"; empty = sha256
     char status[10];
+    size_t chunk_size;  // 0 for a flat checksum, else checksum is a Merkle root
 } file_info_t;
 
 typedef struct {
@@ -51,4 +53,33 @@ typedef struct {
     size_t count;
 } file_list_t;
 
+typedef struct {
+    size_t chunk_size;
+    size_t count;
+    char (*hashes)[65];
+} chunk_list_t;
+
+typedef struct {
+    size_t files_scanned;
+    size_t files_copied;
+    size_t files_delta;
+    size_t files_skipped;
+    size_t files_deleted;
+    size_t bytes_literal;   // written to the destination
+    size_t bytes_matched;   // already identical in the destination
+} sync_stats_t;
+
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    char source[MAX_PATH_LENGTH];   // snapshotted directory
+    char method[16];        // "subvolume", "reflink" or "copy"
+    size_t entries;         // catalog rows cloned
+    time_t created_at;
+} dirsnap_info_t;
+
+typedef struct {
+    dirsnap_info_t* items;
+    size_t count;
+} dirsnap_list_t;
+
 #endif // COMMON_H
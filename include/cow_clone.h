@@ -0,0 +1,32 @@
+// include/cow_clone.h
+#ifndef COW_CLONE_H
+#define COW_CLONE_H
+
+#include "common.h"
+
+// How a tree was cloned, from cheapest to most expensive. A clone reports
+// the most expensive method any of its files needed.
+typedef enum {
+    COW_METHOD_SUBVOLUME,       // one btrfs snapshot ioctl for the whole tree
+    COW_METHOD_REFLINK,         // per-file FICLONE; data extents are shared
+    COW_METHOD_COPY             // filesystem cannot share extents
+} cow_method_t;
+
+const char* cow_method_name(cow_method_t method);
+
+// Clone the directory src to dest (which must not exist). A btrfs
+// subvolume is snapshotted directly (read-only if requested); any other
+// tree is walked and each file reflinked. Files that cannot be reflinked
+// are copied only with allow_copy; otherwise the clone is undone and
+// FM_ERR_PERMISSION returned. Modes and mtimes are preserved.
+int cow_clone_tree(const char* src, const char* dest, int readonly,
+                   int allow_copy, cow_method_t* method);
+
+// Find the cheapest method available for cloning dir by actually
+// reflinking a probe file inside it
+int cow_probe(const char* dir, cow_method_t* method);
+
+// Remove a tree created by cow_clone_tree, including snapshot subvolumes
+int cow_remove_tree(const char* path);
+
+#endif // COW_CLONE_H
@@ -17,4 +17,44 @@ int db_delete_file(const char* path);
 int db_get_file_info(const char* path, file_info_t* file_info);
 int db_list_directory(const char* path, file_list_t* list);
 
+// Stream every active row ordered by (parent_id, name); a visitor result
+// other than FM_SUCCESS stops the scan
+typedef int (*db_file_visitor_t)(const file_info_t* info, void* ctx);
+int db_foreach_active_file(db_file_visitor_t visit, void* ctx);
+
+// Store-wide settings; db_get_setting returns FM_ERR_NOT_FOUND if unset
+int db_get_setting(const char* key, char* value, size_t len);
+int db_set_setting(const char* key, const char* value);
+
+// Chunk hashes of files with chunked checksums
+int db_save_chunks(int file_id, const chunk_list_t* chunks);
+int db_load_chunks(int file_id, chunk_list_t* chunks);
+
+// Clone the active rows of the tree at src to dest in one set-based pass:
+// paths are rewritten, checksums and chunk hashes shared, and parent links
+// remapped. Rows already under dest are replaced. The cloned root gets
+// parent_id and the last component of dest as its name.
+int db_clone_tree(const char* src, const char* dest, int parent_id,
+                  size_t* entries);
+
+// Hard-delete every row (and chunk hash) of the tree at path
+int db_remove_tree(const char* path);
+
+// Snapshot registry; db_dirsnap_get returns FM_ERR_NOT_FOUND if unknown
+int db_dirsnap_add(const dirsnap_info_t* snap);
+int db_dirsnap_get(const char* name, dirsnap_info_t* snap);
+int db_dirsnap_list(dirsnap_list_t* list);
+int db_dirsnap_remove(const char* name);
+
+// Tombstone compaction: drop (or archive) rows deleted more than
+// retention_days ago, in bounded chunks, then reclaim free pages.
+// Catalogs not yet in incremental auto_vacuum mode only reclaim pages
+// when convert is set, which runs a one-time full VACUUM. Statistics of
+// the purged tables are rebuilt when purged is set.
+int db_purge_deleted(int retention_days, int archive, size_t* purged);
+int db_vacuum(int convert, int purged);
+
+// Drop archived rows purged more than retention_days ago
+int db_purge_archive(int retention_days, size_t* purged);
+
 #endif // DB_MANAGER_H
\ No newline at end of file
@@ -0,0 +1,32 @@
+// include/delta.h
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "common.h"
+
+// Unit of comparison between src and dest
+#define DELTA_BLOCK_SIZE (64 * 1024)
+
+// Files smaller than this are cheaper to rewrite than to compare
+#define DELTA_MIN_SIZE (1024 * 1024)
+
+// Byte ranges of the new dest whose contents differ from the old dest
+typedef struct {
+    size_t offset;
+    size_t length;
+} delta_range_t;
+
+typedef struct {
+    delta_range_t* items;
+    size_t count;
+} delta_ranges_t;
+
+// Patch dest in place so its contents match src. Blocks are compared at
+// the same offset and only those that differ are written; dest is then
+// truncated to the size of src. The patch is not atomic, so callers must
+// only mark dest up to date (e.g. copy the mtime) after it succeeds.
+// If changed is not NULL it receives the modified ranges (free items).
+int delta_sync_file(const char* src, const char* dest, sync_stats_t* stats,
+                    delta_ranges_t* changed);
+
+#endif // DELTA_H
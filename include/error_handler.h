@@ -7,11 +7,12 @@
 // Initialize error handling system
 void error_init(void);
 
-// Log an error with details
+// Record an error for this thread and queue it to the event log
 void error_log(int error_code, const char* message);
 
-// Get last error message
+// Get last error message and code of the calling thread
 const char* error_get_last(void);
+int error_get_last_code(void);
 
 // Clear last error
 void error_clear(void);
@@ -0,0 +1,48 @@
+// include/event_log.h
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "common.h"
+
+// Events are queued in per-thread lock-free rings and written as NDJSON
+// by a background thread, so logging never blocks on I/O. When a ring is
+// full the event is dropped and counted instead. Until a log file is
+// open, events are printed to stderr as they happen.
+
+#define FM_LOG_DEBUG_LEVEL 0
+#define FM_LOG_INFO_LEVEL  1
+#define FM_LOG_WARN_LEVEL  2
+#define FM_LOG_ERROR_LEVEL 3
+
+// Default event log name in the store root, overridden by $FM_EVENT_LOG
+#define FM_EVENT_LOG_FILE "fm-events.ndjson"
+
+// Start the writer thread appending to path; flushed and stopped at exit
+int event_log_open(const char* path);
+
+// Drain every ring, stop the writer and close the file
+void event_log_close(void);
+
+// Events below level are discarded at the call site
+void event_log_set_level(int level);
+
+// Level for a name ("debug", "info", "warn", "error"), or -1 if unknown
+int event_log_level_from_name(const char* name);
+
+// Tag subsequent events from this thread with an operation name
+// (e.g. one batch entry); NULL clears it
+void event_log_set_op(const char* op);
+
+void event_log_write(int level, int code, const char* fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Debug events cost nothing unless built with FM_DEBUG
+#ifdef FM_DEBUG
+#define FM_LOG_DEBUG(...) event_log_write(FM_LOG_DEBUG_LEVEL, 0, __VA_ARGS__)
+#else
+#define FM_LOG_DEBUG(...) ((void)0)
+#endif
+#define FM_LOG_INFO(...) event_log_write(FM_LOG_INFO_LEVEL, 0, __VA_ARGS__)
+#define FM_LOG_WARN(...) event_log_write(FM_LOG_WARN_LEVEL, 0, __VA_ARGS__)
+
+#endif // EVENT_LOG_H
@@ -4,8 +4,14 @@
 
 #include "common.h"
 
-// Initialize file management system
-int fm_init(const char* root_path);
+// Initialize file management system. checksum_algo ("sha256", "blake3",
+// "xxh3") is recorded for the store; NULL keeps the current one.
+// chunked turns Merkle checksums for large files on (1) or off (0);
+// -1 keeps the current setting (off for new stores).
+int fm_init(const char* root_path, const char* checksum_algo, int chunked);
+
+// Directory the store lives in; the catalog and event log are kept there
+const char* fm_get_root_path(void);
 
 // File operations
 int fm_create_file(const char* path, size_t size);
@@ -18,8 +24,56 @@ int fm_delete(const char* path);
 int fm_get_file_info(const char* path, file_info_t* info);
 int fm_list_directory(const char* path, file_list_t* list);
 
+// Bring dest in line with src, transferring only new or changed files;
+// entries missing from src are removed from dest when propagate_delete is set
+int fm_sync(const char* src, const char* dest, int propagate_delete,
+            sync_stats_t* stats);
+
+// Rehash a file and compare against the catalog. Files with chunked
+// checksums report the index of every chunk that changed; *bad must be freed.
+int fm_verify(const char* path, size_t** bad, size_t* bad_count);
+
+// Purge tombstones older than retention_days (moving them to the archive
+// if requested), expire archived rows older than archive_days and compact
+// the catalog. convert allows the one-time full VACUUM that switches an
+// older catalog to incremental vacuuming.
+int fm_gc(int retention_days, int archive, int archive_days, int convert,
+          size_t* purged, size_t* archive_purged);
+
+// Copy-on-write snapshots of a directory, kept under FM_DIRSNAP_DIR/<name>.
+// File data is shared with the source (btrfs subvolume snapshot or
+// reflinks) and catalog rows are cloned with their checksums. Where data
+// cannot be shared, creating a snapshot fails unless allow_copy is set.
+#define FM_DIRSNAP_DIR ".snapshots"
+
+int fm_dirsnap_create(const char* dir, const char* name, int allow_copy);
+int fm_dirsnap_list(dirsnap_list_t* list);   // free list->items
+// Probe how dir ("" for the store root) would be snapshotted; *method is
+// "subvolume", "reflink" or "copy" (reported as FM_ERR_PERMISSION)
+int fm_dirsnap_check(const char* dir, const char** method);
+// Replace the snapshotted directory (files and catalog) with the snapshot
+int fm_dirsnap_restore(const char* name);
+int fm_dirsnap_drop(const char* name);
+
 // json
-int fm_batch_do_json(const char *json_file);
+typedef struct {
+    size_t index;               // position in the "from" array
+    int code;
+    char source[MAX_PATH_LENGTH];
+    char message[256];
+} batch_error_t;
+
+typedef struct {
+    size_t done;
+    size_t failed;
+    batch_error_t* errors;      // one record per failed entry; free() it
+} batch_report_t;
+
+// Run a batch manifest. Progress is journaled next to the manifest; with
+// resume set, entries finished by an interrupted run are skipped and a
+// partially copied file continues from its last checkpoint.
+int fm_batch_do_json(const char *json_file, int resume,
+                     batch_report_t *report);
 
 // Cleanup
 void fm_cleanup(void);
@@ -0,0 +1,192 @@
+// src/batch_journal.c
+#include "batch_journal.h"
+#include "error_handler.h"
+#include <inttypes.h>
+#include <stdarg.h>
+
+static void fingerprint(const char *manifest, char *out) {
+  uint64_t hash = 1469598103934665603ULL; // FNV-1a
+  for (const unsigned char *c = (const unsigned char *)manifest; *c; c++) {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  snprintf(out, 17, "%016" PRIx64, hash);
+}
+
+static char *copy_string(const char *text) {
+  char *copy = strdup(text);
+  if (!copy)
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+  return copy;
+}
+
+// Flush a record to disk before the work it describes is relied upon
+static int append(batch_journal_t *journal, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int append(batch_journal_t *journal, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int written = vfprintf(journal->file, fmt, args);
+  va_end(args);
+
+  if (written < 0 || fflush(journal->file) != 0 ||
+      fdatasync(fileno(journal->file)) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to write batch journal");
+    return FM_ERR_SYSTEM;
+  }
+  return FM_SUCCESS;
+}
+
+static void strip_newline(char *line) {
+  size_t len = strlen(line);
+  if (len > 0 && line[len - 1] == '\n')
+    line[len - 1] = '\0';
+}
+
+// *end is set past the last complete line, where appending may resume
+static int replay(batch_journal_t *journal, FILE *file, const char *expected,
+                  long *end) {
+  char line[MAX_PATH_LENGTH + 64];
+  int matched = 0;
+
+  *end = 0;
+  while (fgets(line, sizeof(line), file)) {
+    // A torn last line (crash mid-write) has no newline; ignore it
+    if (!strchr(line, '\n'))
+      break;
+    *end = ftell(file);
+    strip_newline(line);
+
+    size_t index;
+    uint64_t offset;
+    int consumed = 0;
+    if (line[0] == 'M') {
+      matched = strcmp(line + 2, expected) == 0;
+      if (!matched)
+        break;
+    } else if (!matched) {
+      break;
+    } else if (sscanf(line, "D %zu", &index) == 1 &&
+               index < journal->op_count) {
+      journal->done[index] = 1;
+    } else if (sscanf(line, "S %zu %n", &index, &consumed) == 1 && consumed &&
+               index < journal->op_count) {
+      free(journal->dest[index]);
+      journal->dest[index] = copy_string(line + consumed);
+    } else if (sscanf(line, "P %zu %" SCNu64 " %n", &index, &offset,
+                      &consumed) == 2 &&
+               consumed && index < journal->op_count) {
+      free(journal->partial_file[index]);
+      journal->partial_file[index] = copy_string(line + consumed);
+      journal->partial_offset[index] = offset;
+    }
+  }
+
+  if (!matched) {
+    error_log(FM_ERR_INVALID_PATH,
+              "Batch journal belongs to a different manifest");
+    return FM_ERR_INVALID_PATH;
+  }
+  return FM_SUCCESS;
+}
+
+int batch_journal_open(batch_journal_t *journal, const char *manifest_path,
+                       const char *manifest, size_t op_count, int resume) {
+  memset(journal, 0, sizeof(*journal));
+  snprintf(journal->path, MAX_PATH_LENGTH, "%s.journal", manifest_path);
+  journal->op_count = op_count;
+
+  size_t slots = op_count ? op_count : 1;
+  journal->done = calloc(slots, 1);
+  journal->dest = calloc(slots, sizeof(char *));
+  journal->partial_file = calloc(slots, sizeof(char *));
+  journal->partial_offset = calloc(slots, sizeof(uint64_t));
+  if (!journal->done || !journal->dest || !journal->partial_file ||
+      !journal->partial_offset) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    batch_journal_close(journal, 0);
+    return FM_ERR_SYSTEM;
+  }
+
+  char print[17];
+  fingerprint(manifest, print);
+
+  FILE *existing = resume ? fopen(journal->path, "r") : NULL;
+  if (existing) {
+    long end;
+    int result = replay(journal, existing, print, &end);
+    fclose(existing);
+    // Cut off a torn last line, or the next record would be glued to it
+    if (result == FM_SUCCESS && truncate(journal->path, end) != 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to truncate batch journal");
+      result = FM_ERR_SYSTEM;
+    }
+    if (result != FM_SUCCESS) {
+      batch_journal_close(journal, 0);
+      return result;
+    }
+    journal->file = fopen(journal->path, "a");
+  } else {
+    journal->file = fopen(journal->path, "w");
+  }
+
+  if (!journal->file) {
+    error_log(FM_ERR_SYSTEM, "Failed to open batch journal");
+    batch_journal_close(journal, 0);
+    return FM_ERR_SYSTEM;
+  }
+  if (!existing)
+    return append(journal, "M %s\n", print);
+  return FM_SUCCESS;
+}
+
+void batch_journal_close(batch_journal_t *journal, int completed) {
+  if (journal->file) {
+    fclose(journal->file);
+    if (completed)
+      unlink(journal->path);
+  }
+  for (size_t i = 0; journal->dest && i < journal->op_count; i++)
+    free(journal->dest[i]);
+  for (size_t i = 0; journal->partial_file && i < journal->op_count; i++)
+    free(journal->partial_file[i]);
+  free(journal->done);
+  free(journal->dest);
+  free(journal->partial_file);
+  free(journal->partial_offset);
+  memset(journal, 0, sizeof(*journal));
+}
+
+int batch_journal_started(batch_journal_t *journal, size_t index,
+                          const char *dest) {
+  free(journal->dest[index]);
+  journal->dest[index] = copy_string(dest);
+  return append(journal, "S %zu %s\n", index, dest);
+}
+
+int batch_journal_progress(batch_journal_t *journal, size_t index,
+                           uint64_t offset, const char *file) {
+  return append(journal, "P %zu %" PRIu64 " %s\n", index, offset, file);
+}
+
+int batch_journal_done(batch_journal_t *journal, size_t index) {
+  journal->done[index] = 1;
+  return append(journal, "D %zu\n", index);
+}
+
+int batch_journal_is_done(const batch_journal_t *journal, size_t index) {
+  return journal->done[index];
+}
+
+const char *batch_journal_dest(const batch_journal_t *journal, size_t index) {
+  return journal->dest[index];
+}
+
+uint64_t batch_journal_offset(const batch_journal_t *journal, size_t index,
+                              const char *file) {
+  if (!journal->partial_file[index] ||
+      strcmp(journal->partial_file[index], file) != 0)
+    return 0;
+  return journal->partial_offset[index];
+}
@@ -0,0 +1,298 @@
+// src/catalog_snapshot.c
+#include "catalog_snapshot.h"
+#include "db_manager.h"
+#include "error_handler.h"
+#include <sys/mman.h>
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+typedef struct {
+  snapshot_record_t *records;
+  size_t count, capacity;
+  char *strings;
+  size_t strings_size, strings_capacity;
+  uint32_t last_algo; // checksum_algo tags repeat; reuse the previous one
+  int have_algo;
+} builder_t;
+
+static uint64_t path_hash(const char *path) {
+  uint64_t hash = 1469598103934665603ULL; // FNV-1a
+  for (const unsigned char *c = (const unsigned char *)path; *c; c++) {
+    hash ^= *c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static int add_string(builder_t *b, const char *text, uint32_t *offset) {
+  size_t len = strlen(text) + 1;
+  if (b->strings_size + len > UINT32_MAX) {
+    error_log(FM_ERR_SYSTEM, "Snapshot string table too large");
+    return FM_ERR_SYSTEM;
+  }
+  if (b->strings_size + len > b->strings_capacity) {
+    size_t capacity = b->strings_capacity ? b->strings_capacity * 2 : 65536;
+    while (capacity < b->strings_size + len)
+      capacity *= 2;
+    char *strings = realloc(b->strings, capacity);
+    if (!strings) {
+      error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+      return FM_ERR_SYSTEM;
+    }
+    b->strings = strings;
+    b->strings_capacity = capacity;
+  }
+  memcpy(b->strings + b->strings_size, text, len);
+  *offset = (uint32_t)b->strings_size;
+  b->strings_size += len;
+  return FM_SUCCESS;
+}
+
+static int add_record(const file_info_t *info, void *ctx) {
+  builder_t *b = ctx;
+  if (b->count == b->capacity) {
+    size_t capacity = b->capacity ? b->capacity * 2 : 1024;
+    snapshot_record_t *records =
+        realloc(b->records, capacity * sizeof(snapshot_record_t));
+    if (!records) {
+      error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+      return FM_ERR_SYSTEM;
+    }
+    b->records = records;
+    b->capacity = capacity;
+  }
+
+  snapshot_record_t *record = &b->records[b->count];
+  memset(record, 0, sizeof(*record));
+  record->id = info->id;
+  record->parent_id = info->parent_id;
+  record->size = info->size;
+  record->chunk_size = info->chunk_size;
+  record->created_at = info->created_at;
+  record->modified_at = info->modified_at;
+  record->path_hash = path_hash(info->path);
+  record->type = strcmp(info->type, FILE_TYPE_DIRECTORY) == 0
+                     ? SNAPSHOT_TYPE_DIRECTORY
+                     : SNAPSHOT_TYPE_FILE;
+
+  if (add_string(b, info->name, &record->name) != FM_SUCCESS ||
+      add_string(b, info->path, &record->path) != FM_SUCCESS ||
+      add_string(b, info->checksum, &record->checksum) != FM_SUCCESS)
+    return FM_ERR_SYSTEM;
+
+  if (!b->have_algo ||
+      strcmp(b->strings + b->last_algo, info->checksum_algo) != 0) {
+    if (add_string(b, info->checksum_algo, &b->last_algo) != FM_SUCCESS)
+      return FM_ERR_SYSTEM;
+    b->have_algo = 1;
+  }
+  record->checksum_algo = b->last_algo;
+
+  b->count++;
+  return FM_SUCCESS;
+}
+
+// Open addressing with linear probing; each slot holds record index + 1
+static uint32_t *build_index(const builder_t *b, uint64_t *slots) {
+  *slots = 1;
+  while (*slots < b->count * 2)
+    *slots <<= 1;
+
+  uint32_t *index = calloc(*slots, sizeof(uint32_t));
+  if (!index)
+    return NULL;
+  for (size_t i = 0; i < b->count; i++) {
+    uint64_t slot = b->records[i].path_hash & (*slots - 1);
+    while (index[slot])
+      slot = (slot + 1) & (*slots - 1);
+    index[slot] = (uint32_t)(i + 1);
+  }
+  return index;
+}
+
+static int write_at(FILE *file, uint64_t offset, const void *data,
+                    size_t len) {
+  if (fseeko(file, (off_t)offset, SEEK_SET) != 0)
+    return FM_ERR_SYSTEM;
+  if (len && fwrite(data, 1, len, file) != len)
+    return FM_ERR_SYSTEM;
+  return FM_SUCCESS;
+}
+
+int catalog_snapshot_export(const char *path) {
+  builder_t b;
+  memset(&b, 0, sizeof(b));
+  uint32_t *index = NULL;
+  FILE *file = NULL;
+  int result = db_foreach_active_file(add_record, &b);
+  if (result != FM_SUCCESS)
+    goto out;
+  if (b.count >= UINT32_MAX) {
+    error_log(FM_ERR_SYSTEM, "Too many catalog rows for a snapshot");
+    result = FM_ERR_SYSTEM;
+    goto out;
+  }
+
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CATALOG_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = CATALOG_SNAPSHOT_VERSION;
+  header.record_size = sizeof(snapshot_record_t);
+  header.record_count = b.count;
+  header.records_offset = ALIGN8(sizeof(header));
+  header.index_offset =
+      ALIGN8(header.records_offset + b.count * sizeof(snapshot_record_t));
+  index = build_index(&b, &header.index_slots);
+  if (!index) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    result = FM_ERR_SYSTEM;
+    goto out;
+  }
+  header.strings_offset =
+      ALIGN8(header.index_offset + header.index_slots * sizeof(uint32_t));
+  header.strings_size = b.strings_size;
+  header.created_at = time(NULL);
+
+  char tmp_path[MAX_PATH_LENGTH];
+  snprintf(tmp_path, MAX_PATH_LENGTH, "%s.tmp", path);
+  file = fopen(tmp_path, "wb");
+  if (!file) {
+    error_log(FM_ERR_SYSTEM, "Failed to create snapshot file");
+    result = FM_ERR_SYSTEM;
+    goto out;
+  }
+
+  if (write_at(file, 0, &header, sizeof(header)) != FM_SUCCESS ||
+      write_at(file, header.records_offset, b.records,
+               b.count * sizeof(snapshot_record_t)) != FM_SUCCESS ||
+      write_at(file, header.index_offset, index,
+               header.index_slots * sizeof(uint32_t)) != FM_SUCCESS ||
+      write_at(file, header.strings_offset, b.strings, b.strings_size) !=
+          FM_SUCCESS ||
+      fflush(file) != 0 || fsync(fileno(file)) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to write snapshot file");
+    result = FM_ERR_SYSTEM;
+  }
+  if (fclose(file) != 0 && result == FM_SUCCESS) {
+    error_log(FM_ERR_SYSTEM, "Failed to write snapshot file");
+    result = FM_ERR_SYSTEM;
+  }
+  file = NULL;
+
+  // Readers that still map the old file keep their copy
+  if (result == FM_SUCCESS && rename(tmp_path, path) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to replace snapshot file");
+    result = FM_ERR_SYSTEM;
+  }
+  if (result != FM_SUCCESS)
+    unlink(tmp_path);
+
+out:
+  free(index);
+  free(b.records);
+  free(b.strings);
+  return result;
+}
+
+int catalog_snapshot_open(const char *path, catalog_snapshot_t *snap) {
+  memset(snap, 0, sizeof(*snap));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return FM_ERR_NOT_FOUND;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+    close(fd);
+    error_log(FM_ERR_INVALID_PATH, "Not a catalog snapshot");
+    return FM_ERR_INVALID_PATH;
+  }
+
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    error_log(FM_ERR_SYSTEM, "Failed to map catalog snapshot");
+    return FM_ERR_SYSTEM;
+  }
+
+  const snapshot_header_t *header = base;
+  uint64_t length = st.st_size;
+  if (memcmp(header->magic, CATALOG_SNAPSHOT_MAGIC, sizeof(header->magic)) !=
+          0 ||
+      header->version != CATALOG_SNAPSHOT_VERSION ||
+      header->record_size != sizeof(snapshot_record_t) ||
+      header->records_offset + header->record_count * sizeof(snapshot_record_t) >
+          length ||
+      header->index_offset + header->index_slots * sizeof(uint32_t) > length ||
+      header->strings_offset + header->strings_size > length) {
+    munmap(base, length);
+    error_log(FM_ERR_INVALID_PATH, "Not a catalog snapshot");
+    return FM_ERR_INVALID_PATH;
+  }
+
+  snap->base = base;
+  snap->length = length;
+  snap->header = header;
+  snap->records =
+      (const snapshot_record_t *)((const char *)base + header->records_offset);
+  snap->index = (const uint32_t *)((const char *)base + header->index_offset);
+  snap->strings = (const char *)base + header->strings_offset;
+  return FM_SUCCESS;
+}
+
+void catalog_snapshot_close(catalog_snapshot_t *snap) {
+  if (snap->base)
+    munmap(snap->base, snap->length);
+  memset(snap, 0, sizeof(*snap));
+}
+
+const snapshot_record_t *catalog_snapshot_lookup(const catalog_snapshot_t *snap,
+                                                 const char *path) {
+  uint64_t slots = snap->header->index_slots;
+  uint64_t hash = path_hash(path);
+
+  for (uint64_t slot = hash & (slots - 1);; slot = (slot + 1) & (slots - 1)) {
+    uint32_t entry = snap->index[slot];
+    if (entry == 0)
+      return NULL;
+    const snapshot_record_t *record = &snap->records[entry - 1];
+    if (record->path_hash == hash &&
+        strcmp(catalog_snapshot_string(snap, record->path), path) == 0)
+      return record;
+  }
+}
+
+size_t catalog_snapshot_list(const catalog_snapshot_t *snap,
+                             const char *dir_path,
+                             const snapshot_record_t **first) {
+  int64_t parent_id = 0;
+  *first = NULL;
+  if (dir_path[0] && strcmp(dir_path, "/") != 0) {
+    const snapshot_record_t *dir = catalog_snapshot_lookup(snap, dir_path);
+    if (!dir || dir->type != SNAPSHOT_TYPE_DIRECTORY)
+      return 0;
+    parent_id = dir->id;
+  }
+
+  // Records are sorted by parent_id: find the first and the one past last
+  size_t count = snap->header->record_count;
+  size_t lo = 0, hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (snap->records[mid].parent_id < parent_id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t begin = lo;
+  hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (snap->records[mid].parent_id <= parent_id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  *first = &snap->records[begin];
+  return lo - begin;
+}
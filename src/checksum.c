@@ -0,0 +1,463 @@
+// src/checksum.c
+#include "checksum.h"
+#include "error_handler.h"
+#include <openssl/evp.h>
+#include <pthread.h>
+#include <stdint.h>
+#ifdef FM_HAVE_BLAKE3
+#include <blake3.h>
+#endif
+#ifdef FM_HAVE_XXHASH
+#include <xxhash.h>
+#endif
+
+#define MAX_HASH_LEN 32
+#define READ_SIZE (1024 * 1024)
+
+typedef struct {
+  checksum_algo_t algo;
+  EVP_MD_CTX *evp;
+#ifdef FM_HAVE_BLAKE3
+  blake3_hasher blake3;
+#endif
+#ifdef FM_HAVE_XXHASH
+  XXH3_state_t *xxh3;
+#endif
+} hash_ctx_t;
+
+typedef struct {
+  checksum_algo_t algo;
+  const char *path;
+  size_t chunk_size;
+  size_t file_size;
+  const size_t *indexes; // chunk indexes to hash
+  size_t count;
+  size_t first, stride;  // this worker takes indexes[first + k * stride]
+  char (*out)[65];       // hex digests, indexed by chunk index
+  int result;
+} hash_job_t;
+
+static void to_hex(const unsigned char *hash, size_t len, char *hex) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    hex[i * 2] = digits[hash[i] >> 4];
+    hex[i * 2 + 1] = digits[hash[i] & 0xf];
+  }
+  hex[len * 2] = '\0';
+}
+
+static void from_hex(const char *hex, unsigned char *hash, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    unsigned int byte = 0;
+    sscanf(hex + i * 2, "%2x", &byte);
+    hash[i] = (unsigned char)byte;
+  }
+}
+
+int checksum_algo_from_name(const char *name, checksum_algo_t *algo) {
+  if (!name || !name[0] || strcmp(name, "sha256") == 0) {
+    *algo = CHECKSUM_SHA256;
+    return FM_SUCCESS;
+  }
+#ifdef FM_HAVE_BLAKE3
+  if (strcmp(name, "blake3") == 0) {
+    *algo = CHECKSUM_BLAKE3;
+    return FM_SUCCESS;
+  }
+#endif
+#ifdef FM_HAVE_XXHASH
+  if (strcmp(name, "xxh3") == 0) {
+    *algo = CHECKSUM_XXH3;
+    return FM_SUCCESS;
+  }
+#endif
+  error_log(FM_ERR_INVALID_PATH, "Unsupported checksum algorithm");
+  return FM_ERR_INVALID_PATH;
+}
+
+const char *checksum_algo_name(checksum_algo_t algo) {
+  switch (algo) {
+  case CHECKSUM_BLAKE3:
+    return "blake3";
+  case CHECKSUM_XXH3:
+    return "xxh3";
+  default:
+    return "sha256";
+  }
+}
+
+static int hash_init(hash_ctx_t *ctx, checksum_algo_t algo) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->algo = algo;
+  switch (algo) {
+#ifdef FM_HAVE_BLAKE3
+  case CHECKSUM_BLAKE3:
+    blake3_hasher_init(&ctx->blake3);
+    return FM_SUCCESS;
+#endif
+#ifdef FM_HAVE_XXHASH
+  case CHECKSUM_XXH3:
+    ctx->xxh3 = XXH3_createState();
+    if (!ctx->xxh3 || XXH3_128bits_reset(ctx->xxh3) != XXH_OK)
+      return FM_ERR_SYSTEM;
+    return FM_SUCCESS;
+#endif
+  case CHECKSUM_SHA256:
+    ctx->evp = EVP_MD_CTX_new();
+    if (!ctx->evp || EVP_DigestInit_ex(ctx->evp, EVP_sha256(), NULL) != 1)
+      return FM_ERR_SYSTEM;
+    return FM_SUCCESS;
+  default:
+    return FM_ERR_SYSTEM;
+  }
+}
+
+static int hash_update(hash_ctx_t *ctx, const void *data, size_t len) {
+  switch (ctx->algo) {
+#ifdef FM_HAVE_BLAKE3
+  case CHECKSUM_BLAKE3:
+    blake3_hasher_update(&ctx->blake3, data, len);
+    return FM_SUCCESS;
+#endif
+#ifdef FM_HAVE_XXHASH
+  case CHECKSUM_XXH3:
+    return XXH3_128bits_update(ctx->xxh3, data, len) == XXH_OK
+               ? FM_SUCCESS
+               : FM_ERR_SYSTEM;
+#endif
+  default:
+    return EVP_DigestUpdate(ctx->evp, data, len) == 1 ? FM_SUCCESS
+                                                      : FM_ERR_SYSTEM;
+  }
+}
+
+// Writes the digest to out, at most MAX_HASH_LEN bytes
+static int hash_final(hash_ctx_t *ctx, unsigned char *out, size_t *len) {
+  int result = FM_SUCCESS;
+  switch (ctx->algo) {
+#ifdef FM_HAVE_BLAKE3
+  case CHECKSUM_BLAKE3:
+    blake3_hasher_finalize(&ctx->blake3, out, BLAKE3_OUT_LEN);
+    *len = BLAKE3_OUT_LEN;
+    break;
+#endif
+#ifdef FM_HAVE_XXHASH
+  case CHECKSUM_XXH3: {
+    XXH128_canonical_t canonical;
+    XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(ctx->xxh3));
+    memcpy(out, canonical.digest, sizeof(canonical.digest));
+    *len = sizeof(canonical.digest);
+    break;
+  }
+#endif
+  default: {
+    unsigned int hashlen = 0;
+    if (EVP_DigestFinal_ex(ctx->evp, out, &hashlen) != 1)
+      result = FM_ERR_SYSTEM;
+    *len = hashlen;
+    break;
+  }
+  }
+  return result;
+}
+
+static void hash_free(hash_ctx_t *ctx) {
+  EVP_MD_CTX_free(ctx->evp);
+  ctx->evp = NULL;
+#ifdef FM_HAVE_XXHASH
+  XXH3_freeState(ctx->xxh3);
+  ctx->xxh3 = NULL;
+#endif
+}
+
+static int hash_buffer(checksum_algo_t algo, const void *data, size_t len,
+                       unsigned char *out, size_t *out_len) {
+  hash_ctx_t ctx;
+  int result = hash_init(&ctx, algo);
+  if (result == FM_SUCCESS)
+    result = hash_update(&ctx, data, len);
+  if (result == FM_SUCCESS)
+    result = hash_final(&ctx, out, out_len);
+  hash_free(&ctx);
+  return result;
+}
+
+// Digest of [offset, offset + len) read through fd, as hex
+static int hash_range(checksum_algo_t algo, int fd, off_t offset, size_t len,
+                      unsigned char *buffer, char *hex) {
+  unsigned char hash[MAX_HASH_LEN];
+  size_t hashlen = 0;
+  hash_ctx_t ctx;
+  int result = hash_init(&ctx, algo);
+
+  while (result == FM_SUCCESS && len > 0) {
+    size_t want = len < READ_SIZE ? len : READ_SIZE;
+    ssize_t got = pread(fd, buffer, want, offset);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got <= 0) {
+      result = FM_ERR_SYSTEM;
+      break;
+    }
+    result = hash_update(&ctx, buffer, got);
+    offset += got;
+    len -= got;
+  }
+
+  if (result == FM_SUCCESS)
+    result = hash_final(&ctx, hash, &hashlen);
+  hash_free(&ctx);
+  if (result == FM_SUCCESS)
+    to_hex(hash, hashlen, hex);
+  return result;
+}
+
+static void *hash_worker(void *arg) {
+  hash_job_t *job = arg;
+  job->result = FM_SUCCESS;
+
+  int fd = open(job->path, O_RDONLY);
+  unsigned char *buffer = malloc(READ_SIZE);
+  if (fd < 0 || !buffer) {
+    job->result = fd < 0 ? FM_ERR_NOT_FOUND : FM_ERR_SYSTEM;
+    goto out;
+  }
+
+  for (size_t k = job->first; k < job->count; k += job->stride) {
+    size_t index = job->indexes[k];
+    off_t offset = (off_t)index * job->chunk_size;
+    size_t len = job->file_size - offset;
+    if (len > job->chunk_size)
+      len = job->chunk_size;
+    job->result =
+        hash_range(job->algo, fd, offset, len, buffer, job->out[index]);
+    if (job->result != FM_SUCCESS)
+      break;
+  }
+
+out:
+  free(buffer);
+  if (fd >= 0)
+    close(fd);
+  return NULL;
+}
+
+// Hash the listed chunks, spreading them over up to CHECKSUM_MAX_THREADS
+static int hash_chunks(checksum_algo_t algo, const char *path,
+                       size_t chunk_size, size_t file_size,
+                       const size_t *indexes, size_t count, char (*out)[65]) {
+  if (count == 0)
+    return FM_SUCCESS;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t nthreads = cpus > 0 ? (size_t)cpus : 1;
+  if (nthreads > CHECKSUM_MAX_THREADS)
+    nthreads = CHECKSUM_MAX_THREADS;
+  if (nthreads > count)
+    nthreads = count;
+
+  hash_job_t jobs[CHECKSUM_MAX_THREADS];
+  pthread_t threads[CHECKSUM_MAX_THREADS];
+  int started[CHECKSUM_MAX_THREADS] = {0};
+
+  for (size_t t = 0; t < nthreads; t++) {
+    jobs[t] = (hash_job_t){algo,  path,     chunk_size, file_size, indexes,
+                           count, t,        nthreads,   out,       FM_SUCCESS};
+    // Thread 0 runs on the caller, as does any job we failed to spawn
+    if (t > 0)
+      started[t] = pthread_create(&threads[t], NULL, hash_worker, &jobs[t]) == 0;
+  }
+  for (size_t t = 0; t < nthreads; t++) {
+    if (!started[t])
+      hash_worker(&jobs[t]);
+  }
+
+  int result = FM_SUCCESS;
+  for (size_t t = 0; t < nthreads; t++) {
+    if (started[t])
+      pthread_join(threads[t], NULL);
+    if (jobs[t].result != FM_SUCCESS)
+      result = jobs[t].result;
+  }
+  if (result != FM_SUCCESS)
+    error_log(result, "Failed to hash file chunks");
+  return result;
+}
+
+static int file_size_of(const char *path, size_t *size) {
+  struct stat st;
+  if (stat(path, &st) != 0)
+    return FM_ERR_NOT_FOUND;
+  *size = st.st_size;
+  return FM_SUCCESS;
+}
+
+int checksum_file(const char *path, checksum_algo_t algo, char *checksum) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return FM_ERR_NOT_FOUND;
+
+  size_t size;
+  unsigned char *buffer = malloc(READ_SIZE);
+  int result = FM_ERR_SYSTEM;
+  if (buffer && file_size_of(path, &size) == FM_SUCCESS)
+    result = hash_range(algo, fd, 0, size, buffer, checksum);
+  if (result != FM_SUCCESS)
+    error_log(result, "Failed to calculate checksum");
+
+  free(buffer);
+  close(fd);
+  return result;
+}
+
+void checksum_merkle_root(checksum_algo_t algo, const chunk_list_t *chunks,
+                          char *root) {
+  size_t count = chunks->count;
+  unsigned char hash[MAX_HASH_LEN];
+  size_t hashlen = 0;
+  root[0] = '\0';
+
+  if (count == 0) {
+    if (hash_buffer(algo, "", 0, hash, &hashlen) == FM_SUCCESS)
+      to_hex(hash, hashlen, root);
+    return;
+  }
+
+  // Nodes are stored back to back so a pair can be hashed in place
+  size_t node_len = strlen(chunks->hashes[0]) / 2;
+  unsigned char *level = malloc(node_len * count);
+  if (!level)
+    return;
+  for (size_t i = 0; i < count; i++)
+    from_hex(chunks->hashes[i], level + i * node_len, node_len);
+
+  // Pair up nodes level by level; an odd node is carried up unchanged
+  while (count > 1) {
+    size_t next = 0;
+    for (size_t i = 0; i < count; i += 2, next++) {
+      unsigned char *node = level + i * node_len;
+      if (i + 1 == count) {
+        memmove(level + next * node_len, node, node_len);
+        continue;
+      }
+      if (hash_buffer(algo, node, node_len * 2, hash, &hashlen) !=
+          FM_SUCCESS) {
+        free(level);
+        return;
+      }
+      memcpy(level + next * node_len, hash, node_len);
+    }
+    count = next;
+  }
+
+  to_hex(level, node_len, root);
+  free(level);
+}
+
+static int resize_chunks(chunk_list_t *chunks, size_t count) {
+  void *hashes = realloc(chunks->hashes, sizeof(*chunks->hashes) * (count ? count : 1));
+  if (!hashes) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return FM_ERR_SYSTEM;
+  }
+  chunks->hashes = hashes;
+  chunks->count = count;
+  return FM_SUCCESS;
+}
+
+int checksum_file_chunked(const char *path, checksum_algo_t algo,
+                          size_t chunk_size, chunk_list_t *chunks, char *root) {
+  size_t size;
+  if (file_size_of(path, &size) != FM_SUCCESS)
+    return FM_ERR_NOT_FOUND;
+
+  chunks->chunk_size = chunk_size;
+  if (resize_chunks(chunks, (size + chunk_size - 1) / chunk_size) !=
+      FM_SUCCESS)
+    return FM_ERR_SYSTEM;
+
+  size_t *indexes = malloc(sizeof(size_t) * (chunks->count ? chunks->count : 1));
+  if (!indexes) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return FM_ERR_SYSTEM;
+  }
+  for (size_t i = 0; i < chunks->count; i++)
+    indexes[i] = i;
+
+  int result = hash_chunks(algo, path, chunk_size, size, indexes,
+                           chunks->count, chunks->hashes);
+  free(indexes);
+  if (result == FM_SUCCESS)
+    checksum_merkle_root(algo, chunks, root);
+  return result;
+}
+
+int checksum_rehash_chunks(const char *path, checksum_algo_t algo,
+                           chunk_list_t *chunks, const unsigned char *dirty,
+                           char *root) {
+  size_t size;
+  if (file_size_of(path, &size) != FM_SUCCESS)
+    return FM_ERR_NOT_FOUND;
+
+  size_t old_count = chunks->count;
+  size_t count = (size + chunks->chunk_size - 1) / chunks->chunk_size;
+  if (resize_chunks(chunks, count) != FM_SUCCESS)
+    return FM_ERR_SYSTEM;
+
+  size_t *indexes = malloc(sizeof(size_t) * (count ? count : 1));
+  if (!indexes) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return FM_ERR_SYSTEM;
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    // The tail chunk is cheap and its length may have changed
+    if (i >= old_count || i + 1 == count || (dirty && dirty[i]))
+      indexes[n++] = i;
+  }
+
+  int result = hash_chunks(algo, path, chunks->chunk_size, size, indexes, n,
+                           chunks->hashes);
+  free(indexes);
+  if (result == FM_SUCCESS)
+    checksum_merkle_root(algo, chunks, root);
+  return result;
+}
+
+int checksum_verify_chunks(const char *path, checksum_algo_t algo,
+                           const chunk_list_t *chunks, size_t **bad,
+                           size_t *bad_count) {
+  chunk_list_t current = {0};
+  char root[65];
+  *bad = NULL;
+  *bad_count = 0;
+
+  int result =
+      checksum_file_chunked(path, algo, chunks->chunk_size, &current, root);
+  if (result != FM_SUCCESS) {
+    checksum_free_chunks(&current);
+    return result;
+  }
+
+  size_t count = current.count > chunks->count ? current.count : chunks->count;
+  *bad = malloc(sizeof(size_t) * (count ? count : 1));
+  if (!*bad) {
+    checksum_free_chunks(&current);
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return FM_ERR_SYSTEM;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (i >= current.count || i >= chunks->count ||
+        strcmp(current.hashes[i], chunks->hashes[i]) != 0)
+      (*bad)[(*bad_count)++] = i;
+  }
+
+  checksum_free_chunks(&current);
+  return FM_SUCCESS;
+}
+
+void checksum_free_chunks(chunk_list_t *chunks) {
+  free(chunks->hashes);
+  chunks->hashes = NULL;
+  chunks->count = 0;
+}
@@ -0,0 +1,284 @@
+// src/cow_clone.c
+#include "cow_clone.h"
+#include "error_handler.h"
+#include "event_log.h"
+#include <ftw.h>
+#include <linux/btrfs.h>
+#include <linux/fs.h>
+#include <linux/magic.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+
+// Inode number of the root directory of every btrfs subvolume
+#define BTRFS_SUBVOLUME_INO 256
+
+static const char *method_names[] = {"subvolume", "reflink", "copy"};
+
+const char *cow_method_name(cow_method_t method) {
+  return method_names[method];
+}
+
+static int is_subvolume(const char *path) {
+  struct statfs fs;
+  struct stat st;
+  return statfs(path, &fs) == 0 && fs.f_type == BTRFS_SUPER_MAGIC &&
+         stat(path, &st) == 0 && st.st_ino == BTRFS_SUBVOLUME_INO;
+}
+
+// Open the directory containing path; *name points at the last component
+static int open_parent(const char *path, const char **name) {
+  char parent[MAX_PATH_LENGTH];
+  strncpy(parent, path, MAX_PATH_LENGTH - 1);
+  parent[MAX_PATH_LENGTH - 1] = '\0';
+
+  char *slash = strrchr(parent, '/');
+  if (!slash) {
+    *name = path;
+    return open(".", O_RDONLY | O_DIRECTORY);
+  }
+  *name = path + (slash - parent) + 1;
+  if (slash == parent)
+    slash[1] = '\0';
+  else
+    *slash = '\0';
+  return open(parent, O_RDONLY | O_DIRECTORY);
+}
+
+static int snapshot_subvolume(const char *src, const char *dest,
+                              int readonly) {
+  const char *name;
+  int src_fd = open(src, O_RDONLY | O_DIRECTORY);
+  int parent_fd = open_parent(dest, &name);
+  int result = -1;
+  if (src_fd >= 0 && parent_fd >= 0) {
+    struct btrfs_ioctl_vol_args_v2 args;
+    memset(&args, 0, sizeof(args));
+    args.fd = src_fd;
+    args.flags = readonly ? BTRFS_SUBVOL_RDONLY : 0;
+    strncpy(args.name, name, BTRFS_SUBVOL_NAME_MAX);
+    result = ioctl(parent_fd, BTRFS_IOC_SNAP_CREATE_V2, &args);
+  }
+  if (src_fd >= 0)
+    close(src_fd);
+  if (parent_fd >= 0)
+    close(parent_fd);
+  return result;
+}
+
+// Used when extents cannot be shared; copy_file_range still lets the
+// kernel avoid the round trip through user space
+static int copy_data(int in, int out) {
+  ssize_t copied;
+  while ((copied = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+    ;
+  if (copied == 0)
+    return FM_SUCCESS;
+
+  // Both offsets have advanced past what was copied; continue from there
+  char buffer[BUFFER_SIZE * 16];
+  ssize_t bytes;
+  while ((bytes = read(in, buffer, sizeof(buffer))) > 0) {
+    if (write(out, buffer, bytes) != bytes)
+      return FM_ERR_SYSTEM;
+  }
+  return bytes == 0 ? FM_SUCCESS : FM_ERR_SYSTEM;
+}
+
+static int clone_file(const char *src, const char *dest,
+                      const struct stat *st, int allow_copy,
+                      cow_method_t *method) {
+  int in = open(src, O_RDONLY);
+  int out = open(dest, O_WRONLY | O_CREAT | O_EXCL, st->st_mode & 07777);
+  int result = FM_SUCCESS;
+  if (in < 0 || out < 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to open files for clone");
+    result = FM_ERR_SYSTEM;
+  } else if (ioctl(out, FICLONE, in) != 0) {
+    if (!allow_copy) {
+      error_log(FM_ERR_PERMISSION, "Filesystem cannot share file data");
+      result = FM_ERR_PERMISSION;
+    } else {
+      *method = COW_METHOD_COPY;
+      result = copy_data(in, out);
+      if (result != FM_SUCCESS)
+        error_log(FM_ERR_SYSTEM, "Failed to copy file");
+    }
+  }
+
+  if (result == FM_SUCCESS) {
+    struct timespec times[2] = {st->st_atim, st->st_mtim};
+    futimens(out, times);
+  }
+  if (in >= 0)
+    close(in);
+  if (out >= 0 && close(out) != 0 && result == FM_SUCCESS) {
+    error_log(FM_ERR_SYSTEM, "Failed to clone file");
+    result = FM_ERR_SYSTEM;
+  }
+  return result;
+}
+
+static int clone_walk(const char *src, const char *dest, int allow_copy,
+                      cow_method_t *method) {
+  struct stat st;
+  if (lstat(src, &st) != 0) {
+    error_log(FM_ERR_NOT_FOUND, "Clone source does not exist");
+    return FM_ERR_NOT_FOUND;
+  }
+  struct timespec times[2] = {st.st_atim, st.st_mtim};
+
+  if (S_ISREG(st.st_mode))
+    return clone_file(src, dest, &st, allow_copy, method);
+
+  if (S_ISLNK(st.st_mode)) {
+    char target[MAX_PATH_LENGTH];
+    ssize_t len = readlink(src, target, sizeof(target) - 1);
+    if (len < 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to read symlink");
+      return FM_ERR_SYSTEM;
+    }
+    target[len] = '\0';
+    if (symlink(target, dest) != 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to clone symlink");
+      return FM_ERR_SYSTEM;
+    }
+    utimensat(AT_FDCWD, dest, times, AT_SYMLINK_NOFOLLOW);
+    return FM_SUCCESS;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    FM_LOG_WARN("skipping special file %s", src);
+    return FM_SUCCESS;
+  }
+
+  // Writable until the children are in place; the real mode comes last
+  if (mkdir(dest, 0700) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to create directory");
+    return FM_ERR_SYSTEM;
+  }
+
+  DIR *dir = opendir(src);
+  if (!dir) {
+    error_log(FM_ERR_SYSTEM, "Failed to open directory");
+    return FM_ERR_SYSTEM;
+  }
+
+  int result = FM_SUCCESS;
+  struct dirent *entry;
+  while (result == FM_SUCCESS && (entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    char child_src[MAX_PATH_LENGTH];
+    char child_dest[MAX_PATH_LENGTH];
+    snprintf(child_src, MAX_PATH_LENGTH, "%s/%s", src, entry->d_name);
+    snprintf(child_dest, MAX_PATH_LENGTH, "%s/%s", dest, entry->d_name);
+    result = clone_walk(child_src, child_dest, allow_copy, method);
+  }
+  closedir(dir);
+
+  chmod(dest, st.st_mode & 07777);
+  utimensat(AT_FDCWD, dest, times, 0);
+  return result;
+}
+
+int cow_clone_tree(const char *src, const char *dest, int readonly,
+                   int allow_copy, cow_method_t *method) {
+  struct stat st;
+  if (stat(src, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    error_log(FM_ERR_NOT_FOUND, "Clone source is not a directory");
+    return FM_ERR_NOT_FOUND;
+  }
+  if (lstat(dest, &st) == 0) {
+    error_log(FM_ERR_ALREADY_EXISTS, "Clone destination already exists");
+    return FM_ERR_ALREADY_EXISTS;
+  }
+
+  // Nested subvolumes show up as empty directories in the snapshot,
+  // exactly as with `btrfs subvolume snapshot`
+  if (is_subvolume(src)) {
+    if (snapshot_subvolume(src, dest, readonly) == 0) {
+      *method = COW_METHOD_SUBVOLUME;
+      return FM_SUCCESS;
+    }
+    FM_LOG_WARN("subvolume snapshot of %s failed (%s), cloning files", src,
+                strerror(errno));
+  }
+
+  *method = COW_METHOD_REFLINK;
+  int result = clone_walk(src, dest, allow_copy, method);
+  if (result != FM_SUCCESS)
+    cow_remove_tree(dest);
+  return result;
+}
+
+int cow_probe(const char *dir, cow_method_t *method) {
+  if (is_subvolume(dir)) {
+    *method = COW_METHOD_SUBVOLUME;
+    return FM_SUCCESS;
+  }
+
+  char src[MAX_PATH_LENGTH], dest[MAX_PATH_LENGTH];
+  snprintf(src, MAX_PATH_LENGTH, "%s/.fmprobe.XXXXXX", dir);
+  snprintf(dest, MAX_PATH_LENGTH, "%s/.fmprobe.XXXXXX", dir);
+  int in = mkstemp(src);
+  int out = in >= 0 ? mkstemp(dest) : -1;
+  if (in < 0 || out < 0) {
+    if (in >= 0) {
+      close(in);
+      unlink(src);
+    }
+    error_log(FM_ERR_SYSTEM, "Failed to create probe files");
+    return FM_ERR_SYSTEM;
+  }
+
+  // Clone a block of data and read it back through the clone
+  char data[BUFFER_SIZE], back[BUFFER_SIZE];
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = (char)(i * 31);
+  *method = COW_METHOD_COPY;
+  if (pwrite(in, data, sizeof(data), 0) == (ssize_t)sizeof(data) &&
+      ioctl(out, FICLONE, in) == 0 &&
+      pread(out, back, sizeof(back), 0) == (ssize_t)sizeof(back) &&
+      memcmp(data, back, sizeof(data)) == 0)
+    *method = COW_METHOD_REFLINK;
+
+  close(in);
+  close(out);
+  unlink(src);
+  unlink(dest);
+  return FM_SUCCESS;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)type;
+  (void)ftw;
+  return remove(path);
+}
+
+int cow_remove_tree(const char *path) {
+  struct stat st;
+  if (lstat(path, &st) != 0)
+    return FM_SUCCESS;
+
+  if (is_subvolume(path)) {
+    const char *name;
+    int parent_fd = open_parent(path, &name);
+    struct btrfs_ioctl_vol_args args;
+    memset(&args, 0, sizeof(args));
+    strncpy(args.name, name, BTRFS_PATH_NAME_MAX);
+    int destroyed =
+        parent_fd >= 0 && ioctl(parent_fd, BTRFS_IOC_SNAP_DESTROY, &args) == 0;
+    if (parent_fd >= 0)
+      close(parent_fd);
+    if (destroyed)
+      return FM_SUCCESS;
+  }
+
+  if (nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to remove tree");
+    return FM_ERR_SYSTEM;
+  }
+  return FM_SUCCESS;
+}
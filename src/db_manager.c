@@ -1,6 +1,7 @@
 // src/db_manager.c
 #include "db_manager.h"
 #include "error_handler.h"
+#include "event_log.h"
 #include <cstdarg>
 #include <sqlite3.h>
 #include <stdarg.h>
@@ -20,7 +21,63 @@ static const char *CREATE_TABLE_SQL =
     "parent_id INTEGER,"
     "checksum TEXT,"
     "status TEXT DEFAULT 'active',"
-    "FOREIGN KEY (parent_id) REFERENCES fileMana(id));";
+    "chunk_size INTEGER DEFAULT 0,"
+    "checksum_algo TEXT DEFAULT 'sha256',"
+    "FOREIGN KEY (parent_id) REFERENCES fileMana(id));"
+    "CREATE INDEX IF NOT EXISTS idx_fileMana_tombstone "
+    "ON fileMana(modified_at) WHERE status = 'deleted';";
+
+// Store-wide settings, e.g. the checksum algorithm chosen at init
+static const char *CREATE_SETTINGS_SQL =
+    "CREATE TABLE IF NOT EXISTS fmSettings ("
+    "key TEXT PRIMARY KEY,"
+    "value TEXT NOT NULL);";
+
+// Per-chunk hashes of files stored with chunked (Merkle) checksums
+static const char *CREATE_CHUNKS_SQL =
+    "CREATE TABLE IF NOT EXISTS fileChunks ("
+    "file_id INTEGER NOT NULL,"
+    "chunk_index INTEGER NOT NULL,"
+    "checksum TEXT NOT NULL,"
+    "PRIMARY KEY (file_id, chunk_index)) WITHOUT ROWID;";
+
+// Purged tombstones are moved here when gc runs with archiving enabled
+static const char *CREATE_ARCHIVE_SQL =
+    "CREATE TABLE IF NOT EXISTS fileManaArchive ("
+    "id INTEGER PRIMARY KEY,"
+    "name TEXT NOT NULL,"
+    "path TEXT NOT NULL,"
+    "type TEXT NOT NULL,"
+    "size INTEGER,"
+    "created_at TIMESTAMP,"
+    "modified_at TIMESTAMP,"
+    "parent_id INTEGER,"
+    "checksum TEXT,"
+    "status TEXT,"
+    "checksum_algo TEXT,"
+    "purged_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP);"
+    "CREATE INDEX IF NOT EXISTS idx_fileManaArchive_purged "
+    "ON fileManaArchive(purged_at);";
+
+// Copy-on-write snapshots taken with `fm dirsnap`
+static const char *CREATE_DIRSNAPS_SQL =
+    "CREATE TABLE IF NOT EXISTS fmDirSnapshots ("
+    "name TEXT PRIMARY KEY,"
+    "source TEXT NOT NULL,"
+    "method TEXT NOT NULL,"
+    "entries INTEGER DEFAULT 0,"
+    "created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP);";
+
+#define ARCHIVE_COLUMNS                                                        \
+  "id, name, path, type, size, created_at, modified_at, parent_id, "          \
+  "checksum, status, checksum_algo"
+
+// Tombstones removed per transaction, so writers only wait for one chunk
+#define GC_BATCH_SIZE 500
+// Free pages released per incremental_vacuum step
+#define GC_VACUUM_PAGES 1024
+// Rows sampled per index when gc refreshes statistics
+#define GC_ANALYSIS_LIMIT 1000
 
 static int execute_sql(const char *sql, ...) {
   char *error_msg = NULL;
@@ -30,7 +87,7 @@ static int execute_sql(const char *sql, ...) {
   va_start(args, sql);
   vsnprintf(formatted_sql, sizeof(formatted_sql), sql, args);
   va_end(args);
-  printf("exesql: %s\n", formatted_sql);
+  FM_LOG_DEBUG("exesql: %s", formatted_sql);
   if (sqlite3_exec(db, formatted_sql, NULL, NULL, &error_msg) != SQLITE_OK) {
     error_log(FM_ERR_DB_ERROR, error_msg);
     sqlite3_free(error_msg);
@@ -39,6 +96,18 @@ static int execute_sql(const char *sql, ...) {
   return FM_SUCCESS;
 }
 
+// CURRENT_TIMESTAMP values are UTC "YYYY-MM-DD HH:MM:SS"
+static time_t parse_timestamp(const char *text) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+             &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  return timegm(&tm);
+}
+
 static int callback_get_file(void *data, int argc, char **argv,
                              char **col_names) {
   file_info_t *file_info = (file_info_t *)data;
@@ -56,19 +125,80 @@ static int callback_get_file(void *data, int argc, char **argv,
       file_info->size = argv[i] ? atoll(argv[i]) : 0;
     else if (strcmp(col_names[i], "parent_id") == 0)
       file_info->parent_id = argv[i] ? atoi(argv[i]) : 0;
+    else if (strcmp(col_names[i], "created_at") == 0 && argv[i])
+      file_info->created_at = parse_timestamp(argv[i]);
+    else if (strcmp(col_names[i], "modified_at") == 0 && argv[i])
+      file_info->modified_at = parse_timestamp(argv[i]);
     else if (strcmp(col_names[i], "checksum") == 0 && argv[i])
       strncpy(file_info->checksum, argv[i], 64);
+    else if (strcmp(col_names[i], "chunk_size") == 0)
+      file_info->chunk_size = argv[i] ? atoll(argv[i]) : 0;
+    else if (strcmp(col_names[i], "checksum_algo") == 0 && argv[i])
+      strncpy(file_info->checksum_algo, argv[i],
+              sizeof(file_info->checksum_algo) - 1);
   }
   return 0;
 }
 
+static int callback_get_int(void *data, int argc, char **argv,
+                            char **col_names) {
+  (void)col_names;
+  if (argc > 0 && argv[0])
+    *(int *)data = atoi(argv[0]);
+  return 0;
+}
+
+static int query_int(const char *sql, int *value) {
+  char *error_msg = NULL;
+  *value = 0;
+  if (sqlite3_exec(db, sql, callback_get_int, value, &error_msg) !=
+      SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, error_msg);
+    sqlite3_free(error_msg);
+    return FM_ERR_DB_ERROR;
+  }
+  return FM_SUCCESS;
+}
+
+// Catalogs created by older versions lack newer columns
+static int add_column_if_missing(const char *table, const char *column,
+                                 const char *decl) {
+  char sql[256];
+  int present;
+  snprintf(sql, sizeof(sql),
+           "SELECT COUNT(*) FROM pragma_table_info('%s') WHERE name = '%s';",
+           table, column);
+  if (query_int(sql, &present) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (present)
+    return FM_SUCCESS;
+  return execute_sql("ALTER TABLE %s ADD COLUMN %s %s;", table, column, decl);
+}
+
 int db_init(const char *db_path) {
   if (sqlite3_open(db_path, &db) != SQLITE_OK) {
     error_log(FM_ERR_DB_ERROR, sqlite3_errmsg(db));
     return FM_ERR_DB_ERROR;
   }
 
-  return execute_sql(CREATE_TABLE_SQL);
+  sqlite3_busy_timeout(db, 5000);
+
+  // Only takes effect on a fresh database; db_vacuum converts older ones
+  if (execute_sql("PRAGMA auto_vacuum = INCREMENTAL;") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (execute_sql(CREATE_TABLE_SQL) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (add_column_if_missing("fileMana", "chunk_size", "INTEGER DEFAULT 0") !=
+          FM_SUCCESS ||
+      add_column_if_missing("fileMana", "checksum_algo",
+                            "TEXT DEFAULT 'sha256'") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (execute_sql(CREATE_CHUNKS_SQL) != FM_SUCCESS ||
+      execute_sql(CREATE_SETTINGS_SQL) != FM_SUCCESS ||
+      execute_sql(CREATE_ARCHIVE_SQL) != FM_SUCCESS ||
+      execute_sql(CREATE_DIRSNAPS_SQL) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  return add_column_if_missing("fileManaArchive", "checksum_algo", "TEXT");
 }
 
 void db_close(void) {
@@ -78,25 +208,423 @@ void db_close(void) {
   }
 }
 
-int db_insert_file(const file_info_t *file_info) {
+// A tombstone still holds the UNIQUE path slot; it is dropped (not
+// archived, that is gc's job) inside the transaction of the insert
+static int db_reclaim_path(const char *path) {
   return execute_sql(
-      "INSERT INTO fileMana (name, path, type, size, parent_id, checksum) "
-      "VALUES ('%s', '%s', '%s', %zu, %d, '%s');",
-      file_info->name, file_info->path, file_info->type, file_info->size,
-      file_info->parent_id, file_info->checksum);
+      "DELETE FROM fileChunks WHERE file_id IN ("
+      "SELECT id FROM fileMana WHERE path = '%s' AND status = 'deleted');"
+      "DELETE FROM fileMana WHERE path = '%s' AND status = 'deleted';",
+      path, path);
+}
+
+int db_insert_file(const file_info_t *file_info) {
+  if (execute_sql("BEGIN IMMEDIATE;") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+
+  if (db_reclaim_path(file_info->path) != FM_SUCCESS ||
+      execute_sql(
+          "INSERT INTO fileMana (name, path, type, size, parent_id, checksum, "
+          "chunk_size, checksum_algo) "
+          "VALUES ('%s', '%s', '%s', %zu, %d, '%s', %zu, '%s');",
+          file_info->name, file_info->path, file_info->type, file_info->size,
+          file_info->parent_id, file_info->checksum, file_info->chunk_size,
+          file_info->checksum_algo) != FM_SUCCESS) {
+    execute_sql("ROLLBACK;");
+    return FM_ERR_DB_ERROR;
+  }
+  return execute_sql("COMMIT;");
 }
 
 int db_update_file(const file_info_t *file_info) {
   return execute_sql("UPDATE fileMana SET name = '%s', size = %zu, modified_at "
                      "= CURRENT_TIMESTAMP, "
-                     "checksum = '%s' WHERE path = '%s';",
+                     "checksum = '%s', chunk_size = %zu, checksum_algo = '%s' "
+                     "WHERE path = '%s';",
                      file_info->name, file_info->size, file_info->checksum,
+                     file_info->chunk_size, file_info->checksum_algo,
                      file_info->path);
 }
 
 int db_delete_file(const char *path) {
   return execute_sql(
-      "UPDATE fileMana SET status = 'deleted' WHERE path = '%s';", path);
+      "UPDATE fileMana SET status = 'deleted', modified_at = CURRENT_TIMESTAMP "
+      "WHERE path = '%s' AND status = 'active';",
+      path);
+}
+
+int db_purge_deleted(int retention_days, int archive, size_t *purged) {
+  // Same rows for both statements: the chunk is chosen inside one
+  // transaction and ordered by id
+  const char *chunk = "SELECT id FROM fileMana WHERE status = 'deleted' "
+                      "AND modified_at < datetime('now', '-%d days') "
+                      "ORDER BY id LIMIT %d";
+  char chunk_sql[512];
+  snprintf(chunk_sql, sizeof(chunk_sql), chunk, retention_days, GC_BATCH_SIZE);
+
+  *purged = 0;
+  for (;;) {
+    if (execute_sql("BEGIN IMMEDIATE;") != FM_SUCCESS)
+      return FM_ERR_DB_ERROR;
+
+    if (archive &&
+        execute_sql("INSERT INTO fileManaArchive (" ARCHIVE_COLUMNS ") "
+                    "SELECT " ARCHIVE_COLUMNS " FROM fileMana "
+                    "WHERE id IN (%s);",
+                    chunk_sql) != FM_SUCCESS) {
+      execute_sql("ROLLBACK;");
+      return FM_ERR_DB_ERROR;
+    }
+
+    if (execute_sql("DELETE FROM fileChunks WHERE file_id IN (%s);"
+                    "DELETE FROM fileMana WHERE id IN (%s);",
+                    chunk_sql, chunk_sql) != FM_SUCCESS) {
+      execute_sql("ROLLBACK;");
+      return FM_ERR_DB_ERROR;
+    }
+
+    int changes = sqlite3_changes(db);
+    if (execute_sql("COMMIT;") != FM_SUCCESS)
+      return FM_ERR_DB_ERROR;
+
+    *purged += changes;
+    if (changes < GC_BATCH_SIZE)
+      break;
+  }
+  return FM_SUCCESS;
+}
+
+int db_purge_archive(int retention_days, size_t *purged) {
+  *purged = 0;
+  for (;;) {
+    if (execute_sql("DELETE FROM fileManaArchive WHERE id IN ("
+                    "SELECT id FROM fileManaArchive "
+                    "WHERE purged_at < datetime('now', '-%d days') "
+                    "ORDER BY id LIMIT %d);",
+                    retention_days, GC_BATCH_SIZE) != FM_SUCCESS)
+      return FM_ERR_DB_ERROR;
+
+    int changes = sqlite3_changes(db);
+    *purged += changes;
+    if (changes < GC_BATCH_SIZE)
+      break;
+  }
+  return FM_SUCCESS;
+}
+
+int db_vacuum(int convert, int purged) {
+  int mode;
+  if (query_int("PRAGMA auto_vacuum;", &mode) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+
+  if (mode != 2 && convert) {
+    // Switching an existing database to incremental mode needs one full
+    // VACUUM, which locks the catalog for its whole duration
+    if (execute_sql("PRAGMA auto_vacuum = INCREMENTAL; VACUUM;") !=
+        FM_SUCCESS)
+      return FM_ERR_DB_ERROR;
+  } else if (mode != 2) {
+    FM_LOG_WARN("catalog does not use incremental auto_vacuum; free pages "
+                "are kept until gc --convert");
+  } else {
+    int free_pages;
+    do {
+      if (execute_sql("PRAGMA incremental_vacuum(%d);", GC_VACUUM_PAGES) !=
+              FM_SUCCESS ||
+          query_int("PRAGMA freelist_count;", &free_pages) != FM_SUCCESS)
+        return FM_ERR_DB_ERROR;
+    } while (free_pages > 0);
+  }
+
+  // PRAGMA optimize only re-analyzes tables that grew, never ones a purge
+  // shrank; a sampled ANALYZE keeps the cost bounded on large catalogs
+  if (purged &&
+      execute_sql("PRAGMA analysis_limit = %d; ANALYZE fileMana; "
+                  "ANALYZE fileChunks; ANALYZE fileManaArchive;",
+                  GC_ANALYSIS_LIMIT) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  return execute_sql("PRAGMA optimize;");
+}
+
+static int callback_get_setting(void *data, int argc, char **argv,
+                                char **col_names) {
+  (void)col_names;
+  char **value = (char **)data;
+  if (argc > 0 && argv[0])
+    *value = strdup(argv[0]);
+  return 0;
+}
+
+int db_get_setting(const char *key, char *value, size_t len) {
+  char *error_msg = NULL;
+  char *found = NULL;
+  char sql[256];
+  snprintf(sql, sizeof(sql), "SELECT value FROM fmSettings WHERE key = '%s';",
+           key);
+
+  if (sqlite3_exec(db, sql, callback_get_setting, &found, &error_msg) !=
+      SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, error_msg);
+    sqlite3_free(error_msg);
+    return FM_ERR_DB_ERROR;
+  }
+  if (!found)
+    return FM_ERR_NOT_FOUND;
+
+  strncpy(value, found, len - 1);
+  value[len - 1] = '\0';
+  free(found);
+  return FM_SUCCESS;
+}
+
+int db_set_setting(const char *key, const char *value) {
+  return execute_sql(
+      "INSERT OR REPLACE INTO fmSettings (key, value) VALUES ('%s', '%s');",
+      key, value);
+}
+
+int db_save_chunks(int file_id, const chunk_list_t *chunks) {
+  if (execute_sql("BEGIN;") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (execute_sql("DELETE FROM fileChunks WHERE file_id = %d;", file_id) !=
+      FM_SUCCESS) {
+    execute_sql("ROLLBACK;");
+    return FM_ERR_DB_ERROR;
+  }
+
+  // Large files have thousands of chunks; reuse one prepared statement
+  sqlite3_stmt *stmt = NULL;
+  int rc = sqlite3_prepare_v2(db,
+                              "INSERT INTO fileChunks (file_id, chunk_index, "
+                              "checksum) VALUES (?, ?, ?);",
+                              -1, &stmt, NULL);
+  for (size_t i = 0; rc == SQLITE_OK && i < chunks->count; i++) {
+    sqlite3_bind_int(stmt, 1, file_id);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)i);
+    sqlite3_bind_text(stmt, 3, chunks->hashes[i], -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+      rc = SQLITE_ERROR;
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  if (rc != SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, sqlite3_errmsg(db));
+    execute_sql("ROLLBACK;");
+    return FM_ERR_DB_ERROR;
+  }
+  return execute_sql("COMMIT;");
+}
+
+static int callback_load_chunk(void *data, int argc, char **argv,
+                               char **col_names) {
+  (void)argc;
+  (void)col_names;
+  chunk_list_t *chunks = (chunk_list_t *)data;
+  void *hashes = realloc(chunks->hashes,
+                         (chunks->count + 1) * sizeof(*chunks->hashes));
+  if (!hashes) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return 1;
+  }
+  chunks->hashes = hashes;
+  strncpy(chunks->hashes[chunks->count], argv[0] ? argv[0] : "", 64);
+  chunks->hashes[chunks->count][64] = '\0';
+  chunks->count++;
+  return 0;
+}
+
+int db_load_chunks(int file_id, chunk_list_t *chunks) {
+  char *error_msg = NULL;
+  char sql[256];
+  snprintf(sql, sizeof(sql),
+           "SELECT checksum FROM fileChunks WHERE file_id = %d "
+           "ORDER BY chunk_index;",
+           file_id);
+
+  chunks->count = 0;
+  chunks->hashes = NULL;
+  if (sqlite3_exec(db, sql, callback_load_chunk, chunks, &error_msg) !=
+      SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, error_msg);
+    sqlite3_free(error_msg);
+    return FM_ERR_DB_ERROR;
+  }
+  return FM_SUCCESS;
+}
+
+// Rows of the tree rooted at :root. Children sort between "root/" and
+// "root0" ('0' follows '/'), so the path index is used and no LIKE
+// escaping is needed.
+#define IN_TREE(column, root)                                                  \
+  "(" column " = " root " OR (" column " > " root " || '/' AND " column      \
+  " < " root " || '0'))"
+
+// Run one statement of a tree operation with the named parameters it uses
+static int tree_step(const char *sql, const char *src, const char *dest,
+                     const char *name, int parent_id, int *changes) {
+  sqlite3_stmt *stmt = NULL;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, sqlite3_errmsg(db));
+    return FM_ERR_DB_ERROR;
+  }
+  int index;
+  if ((index = sqlite3_bind_parameter_index(stmt, ":src")) > 0)
+    sqlite3_bind_text(stmt, index, src, -1, SQLITE_STATIC);
+  if ((index = sqlite3_bind_parameter_index(stmt, ":dest")) > 0)
+    sqlite3_bind_text(stmt, index, dest, -1, SQLITE_STATIC);
+  if ((index = sqlite3_bind_parameter_index(stmt, ":name")) > 0)
+    sqlite3_bind_text(stmt, index, name, -1, SQLITE_STATIC);
+  if ((index = sqlite3_bind_parameter_index(stmt, ":parent")) > 0)
+    sqlite3_bind_int(stmt, index, parent_id);
+
+  int rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    error_log(FM_ERR_DB_ERROR, sqlite3_errmsg(db));
+    return FM_ERR_DB_ERROR;
+  }
+  if (changes)
+    *changes = sqlite3_changes(db);
+  return FM_SUCCESS;
+}
+
+int db_clone_tree(const char *src, const char *dest, int parent_id,
+                  size_t *entries) {
+  static const char *steps[] = {
+      // Whatever dest held before is replaced, tombstones included, the
+      // same way db_insert_file reclaims a path
+      "DELETE FROM fileChunks WHERE file_id IN ("
+      "SELECT id FROM fileMana WHERE " IN_TREE("path", ":dest") ");",
+      "DELETE FROM fileMana WHERE " IN_TREE("path", ":dest") ";",
+      // Clones keep the source's checksums and timestamps; parent_id still
+      // points into src until the next step
+      "INSERT INTO fileMana (name, path, type, size, created_at, "
+      "modified_at, parent_id, checksum, status, chunk_size, checksum_algo) "
+      "SELECT CASE WHEN path = :src THEN :name ELSE name END, "
+      ":dest || substr(path, length(:src) + 1), type, size, created_at, "
+      "modified_at, CASE WHEN path = :src THEN :parent ELSE parent_id END, "
+      "checksum, 'active', chunk_size, checksum_algo FROM fileMana "
+      "WHERE status = 'active' AND " IN_TREE("path", ":src") ";",
+      "UPDATE fileMana SET parent_id = ("
+      "SELECT clone.id FROM fileMana AS old JOIN fileMana AS clone "
+      "ON clone.path = :dest || substr(old.path, length(:src) + 1) "
+      "WHERE old.id = fileMana.parent_id) "
+      "WHERE path > :dest || '/' AND path < :dest || '0';",
+      "INSERT INTO fileChunks (file_id, chunk_index, checksum) "
+      "SELECT clone.id, chunk.chunk_index, chunk.checksum "
+      "FROM fileMana AS old JOIN fileChunks AS chunk ON chunk.file_id = old.id "
+      "JOIN fileMana AS clone "
+      "ON clone.path = :dest || substr(old.path, length(:src) + 1) "
+      "WHERE old.status = 'active' AND " IN_TREE("old.path", ":src") ";",
+  };
+  const size_t insert_step = 2;
+
+  const char *name = strrchr(dest, '/');
+  name = name ? name + 1 : dest;
+
+  if (execute_sql("BEGIN IMMEDIATE;") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+    int changes;
+    if (tree_step(steps[i], src, dest, name, parent_id, &changes) !=
+        FM_SUCCESS) {
+      execute_sql("ROLLBACK;");
+      return FM_ERR_DB_ERROR;
+    }
+    if (i == insert_step)
+      *entries = changes;
+  }
+  return execute_sql("COMMIT;");
+}
+
+int db_remove_tree(const char *path) {
+  if (execute_sql("BEGIN IMMEDIATE;") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (tree_step("DELETE FROM fileChunks WHERE file_id IN ("
+                "SELECT id FROM fileMana WHERE " IN_TREE("path", ":src") ");",
+                path, NULL, NULL, 0, NULL) != FM_SUCCESS ||
+      tree_step("DELETE FROM fileMana WHERE " IN_TREE("path", ":src") ";",
+                path, NULL, NULL, 0, NULL) != FM_SUCCESS) {
+    execute_sql("ROLLBACK;");
+    return FM_ERR_DB_ERROR;
+  }
+  return execute_sql("COMMIT;");
+}
+
+int db_dirsnap_add(const dirsnap_info_t *snap) {
+  return execute_sql(
+      "INSERT INTO fmDirSnapshots (name, source, method, entries) "
+      "VALUES ('%s', '%s', '%s', %zu);",
+      snap->name, snap->source, snap->method, snap->entries);
+}
+
+int db_dirsnap_remove(const char *name) {
+  return execute_sql("DELETE FROM fmDirSnapshots WHERE name = '%s';", name);
+}
+
+static int callback_list_dirsnap(void *data, int argc, char **argv,
+                                 char **col_names) {
+  dirsnap_list_t *list = (dirsnap_list_t *)data;
+  dirsnap_info_t *items =
+      realloc(list->items, (list->count + 1) * sizeof(dirsnap_info_t));
+  if (!items) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    return 1;
+  }
+  list->items = items;
+
+  dirsnap_info_t *snap = &items[list->count++];
+  memset(snap, 0, sizeof(*snap));
+  for (int i = 0; i < argc; i++) {
+    if (!argv[i])
+      continue;
+    if (strcmp(col_names[i], "name") == 0)
+      strncpy(snap->name, argv[i], MAX_NAME_LENGTH - 1);
+    else if (strcmp(col_names[i], "source") == 0)
+      strncpy(snap->source, argv[i], MAX_PATH_LENGTH - 1);
+    else if (strcmp(col_names[i], "method") == 0)
+      strncpy(snap->method, argv[i], sizeof(snap->method) - 1);
+    else if (strcmp(col_names[i], "entries") == 0)
+      snap->entries = atoll(argv[i]);
+    else if (strcmp(col_names[i], "created_at") == 0)
+      snap->created_at = parse_timestamp(argv[i]);
+  }
+  return 0;
+}
+
+static int query_dirsnaps(const char *sql, dirsnap_list_t *list) {
+  char *error_msg = NULL;
+  list->count = 0;
+  list->items = NULL;
+  if (sqlite3_exec(db, sql, callback_list_dirsnap, list, &error_msg) !=
+      SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, error_msg);
+    sqlite3_free(error_msg);
+    return FM_ERR_DB_ERROR;
+  }
+  return FM_SUCCESS;
+}
+
+int db_dirsnap_list(dirsnap_list_t *list) {
+  return query_dirsnaps(
+      "SELECT * FROM fmDirSnapshots ORDER BY created_at, name;", list);
+}
+
+int db_dirsnap_get(const char *name, dirsnap_info_t *snap) {
+  char sql[512];
+  snprintf(sql, sizeof(sql), "SELECT * FROM fmDirSnapshots WHERE name = '%s';",
+           name);
+  dirsnap_list_t list;
+  if (query_dirsnaps(sql, &list) != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+  if (list.count == 0) {
+    free(list.items);
+    return FM_ERR_NOT_FOUND;
+  }
+  *snap = list.items[0];
+  free(list.items);
+  return FM_SUCCESS;
 }
 
 int db_get_file_info(const char *path, file_info_t *file_info) {
@@ -152,6 +680,39 @@ int db_list_directory(const char *path, file_list_t *list) {
   return FM_SUCCESS;
 }
 
+typedef struct {
+  db_file_visitor_t visit;
+  void *ctx;
+} visit_state_t;
+
+static int callback_visit_file(void *data, int argc, char **argv,
+                               char **col_names) {
+  visit_state_t *state = (visit_state_t *)data;
+  file_info_t info;
+  memset(&info, 0, sizeof(info));
+  callback_get_file(&info, argc, argv, col_names);
+  return state->visit(&info, state->ctx) != FM_SUCCESS;
+}
+
+int db_foreach_active_file(db_file_visitor_t visit, void *ctx) {
+  char *error_msg = NULL;
+  visit_state_t state = {visit, ctx};
+  const char *sql = "SELECT * FROM fileMana WHERE status = 'active' "
+                    "ORDER BY IFNULL(parent_id, 0), name;";
+
+  int rc = sqlite3_exec(db, sql, callback_visit_file, &state, &error_msg);
+  if (rc == SQLITE_ABORT) {
+    sqlite3_free(error_msg);
+    return FM_ERR_SYSTEM; // the visitor stopped the scan and logged why
+  }
+  if (rc != SQLITE_OK) {
+    error_log(FM_ERR_DB_ERROR, error_msg);
+    sqlite3_free(error_msg);
+    return FM_ERR_DB_ERROR;
+  }
+  return FM_SUCCESS;
+}
+
 int db_execute_sql(const char *fmt, ...) {
   va_list args;
   va_start(args, fmt);
@@ -0,0 +1,125 @@
+// src/delta.c
+#include "delta.h"
+#include "error_handler.h"
+
+static void add_range(delta_ranges_t *ranges, size_t offset, size_t length) {
+  if (!ranges || length == 0)
+    return;
+  if (ranges->count > 0) {
+    delta_range_t *last = &ranges->items[ranges->count - 1];
+    if (last->offset + last->length == offset) {
+      last->length += length;
+      return;
+    }
+  }
+  void *items =
+      realloc(ranges->items, (ranges->count + 1) * sizeof(delta_range_t));
+  if (!items)
+    return;
+  ranges->items = items;
+  ranges->items[ranges->count++] = (delta_range_t){offset, length};
+}
+
+static ssize_t read_block(int fd, unsigned char *buffer, size_t len,
+                          off_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t bytes = pread(fd, buffer + done, len - done, offset + done);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes < 0)
+      return -1;
+    if (bytes == 0)
+      break;
+    done += bytes;
+  }
+  return done;
+}
+
+static int write_block(int fd, const unsigned char *buffer, size_t len,
+                       off_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t bytes = pwrite(fd, buffer + done, len - done, offset + done);
+    if (bytes < 0 && errno == EINTR)
+      continue;
+    if (bytes < 0)
+      return FM_ERR_SYSTEM;
+    done += bytes;
+  }
+  return FM_SUCCESS;
+}
+
+int delta_sync_file(const char *src, const char *dest, sync_stats_t *stats,
+                    delta_ranges_t *changed) {
+  int result = FM_ERR_SYSTEM;
+  unsigned char *buffer = NULL;
+  struct stat src_st, dest_st;
+  if (changed) {
+    changed->items = NULL;
+    changed->count = 0;
+  }
+
+  int src_fd = open(src, O_RDONLY);
+  int dest_fd = open(dest, O_RDWR);
+  if (src_fd < 0 || dest_fd < 0 || fstat(src_fd, &src_st) != 0 ||
+      fstat(dest_fd, &dest_st) != 0) {
+    error_log(FM_ERR_NOT_FOUND, "Failed to open files for delta transfer");
+    result = FM_ERR_NOT_FOUND;
+    goto out;
+  }
+
+  buffer = malloc(2 * DELTA_BLOCK_SIZE);
+  if (!buffer) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    goto out;
+  }
+  unsigned char *src_block = buffer;
+  unsigned char *dest_block = buffer + DELTA_BLOCK_SIZE;
+  posix_fadvise(src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(dest_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  size_t src_size = src_st.st_size;
+  size_t dest_size = dest_st.st_size;
+  for (size_t offset = 0; offset < src_size; offset += DELTA_BLOCK_SIZE) {
+    ssize_t len = read_block(src_fd, src_block, DELTA_BLOCK_SIZE, offset);
+    ssize_t old_len = offset < dest_size ? read_block(dest_fd, dest_block,
+                                                      DELTA_BLOCK_SIZE, offset)
+                                         : 0;
+    if (len < 0 || old_len < 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to read files for delta transfer");
+      goto out;
+    }
+    if (len == 0)
+      break;
+
+    if (old_len == len && memcmp(src_block, dest_block, len) == 0) {
+      stats->bytes_matched += len;
+      continue;
+    }
+    if (write_block(dest_fd, src_block, len, offset) != FM_SUCCESS) {
+      error_log(FM_ERR_SYSTEM, "Failed to patch destination file");
+      goto out;
+    }
+    stats->bytes_literal += len;
+    add_range(changed, offset, len);
+  }
+
+  if (dest_size > src_size && ftruncate(dest_fd, src_size) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to truncate destination file");
+    goto out;
+  }
+  if (fdatasync(dest_fd) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to flush destination file");
+    goto out;
+  }
+  result = FM_SUCCESS;
+
+out:
+  free(buffer);
+  if (src_fd >= 0)
+    close(src_fd);
+  if (dest_fd >= 0)
+    close(dest_fd);
+  return result;
+}
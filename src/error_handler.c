@@ -1,25 +1,33 @@
 // src/error_handler.c
 #include "error_handler.h"
+#include "event_log.h"
 
-static char last_error[1024] = {0};
-static int last_error_code = FM_SUCCESS;
+// Per thread, so concurrent operations keep their own last error
+static _Thread_local char last_error[1024] = {0};
+static _Thread_local int last_error_code = FM_SUCCESS;
 
 void error_init(void) {
     error_clear();
 }
 
 void error_log(int error_code, const char* message) {
+    if (!message)
+        message = "";
     last_error_code = error_code;
     strncpy(last_error, message, sizeof(last_error) - 1);
     last_error[sizeof(last_error) - 1] = '\0';
-    fprintf(stderr, "Error %d: %s\n", error_code, message);
+    event_log_write(FM_LOG_ERROR_LEVEL, error_code, "%s", message);
 }
 
 const char* error_get_last(void) {
     return last_error;
 }
 
+int error_get_last_code(void) {
+    return last_error_code;
+}
+
 void error_clear(void) {
     last_error[0] = '\0';
     last_error_code = FM_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,239 @@
+// src/event_log.c
+#include "event_log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#define RING_SLOTS 256 // power of two
+#define OP_LENGTH 64
+#define MSG_LENGTH 192
+#define WRITER_INTERVAL_NS (20 * 1000 * 1000)
+
+typedef struct {
+  struct timespec ts;
+  int level;
+  int code;
+  unsigned int tid;
+  char op[OP_LENGTH];
+  char msg[MSG_LENGTH];
+} event_t;
+
+// Single producer (the owning thread), single consumer (the writer)
+typedef struct ring {
+  event_t slots[RING_SLOTS];
+  atomic_size_t head; // next slot the owner fills
+  atomic_size_t tail; // next slot the writer drains
+  atomic_int in_use;  // owned by a live thread; reused once released
+  struct ring *next;  // rings are only ever prepended, never unlinked
+} ring_t;
+
+static _Atomic(ring_t *) rings = NULL;
+static atomic_uint next_tid = 1;
+static atomic_size_t dropped = 0;
+static atomic_int min_level = FM_LOG_DEBUG_LEVEL;
+static atomic_int stop_writer = 0;
+static atomic_int writing = 0; // a writer thread owns out
+
+static _Thread_local ring_t *local_ring = NULL;
+static _Thread_local unsigned int local_tid = 0;
+static _Thread_local char local_op[OP_LENGTH] = {0};
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t writer;
+static FILE *out = NULL;
+static int registered_atexit = 0;
+
+static const char *level_names[] = {"debug", "info", "warn", "error"};
+
+static void release_ring(void *ring) {
+  atomic_store(&((ring_t *)ring)->in_use, 0);
+}
+
+static void make_key(void) { pthread_key_create(&ring_key, release_ring); }
+
+static ring_t *acquire_ring(void) {
+  if (local_ring)
+    return local_ring;
+  pthread_once(&key_once, make_key);
+
+  ring_t *ring;
+  for (ring = atomic_load(&rings); ring; ring = ring->next) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1))
+      break;
+  }
+
+  if (!ring) {
+    ring = calloc(1, sizeof(ring_t));
+    if (!ring)
+      return NULL;
+    atomic_init(&ring->in_use, 1);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+      ;
+  }
+
+  pthread_setspecific(ring_key, ring);
+  local_tid = atomic_fetch_add(&next_tid, 1);
+  local_ring = ring;
+  return ring;
+}
+
+void event_log_set_level(int level) { atomic_store(&min_level, level); }
+
+int event_log_level_from_name(const char *name) {
+  for (int level = FM_LOG_DEBUG_LEVEL; level <= FM_LOG_ERROR_LEVEL; level++) {
+    if (strcmp(name, level_names[level]) == 0)
+      return level;
+  }
+  return -1;
+}
+
+void event_log_set_op(const char *op) {
+  if (!op) {
+    local_op[0] = '\0';
+    return;
+  }
+  strncpy(local_op, op, OP_LENGTH - 1);
+  local_op[OP_LENGTH - 1] = '\0';
+}
+
+void event_log_write(int level, int code, const char *fmt, ...) {
+  if (level < atomic_load_explicit(&min_level, memory_order_relaxed))
+    return;
+
+  va_list args;
+  if (!atomic_load_explicit(&writing, memory_order_acquire)) {
+    if (level < FM_LOG_DEBUG_LEVEL || level > FM_LOG_ERROR_LEVEL)
+      level = FM_LOG_ERROR_LEVEL;
+    char msg[MSG_LENGTH];
+    va_start(args, fmt);
+    vsnprintf(msg, MSG_LENGTH, fmt, args);
+    va_end(args);
+    if (code != 0)
+      fprintf(stderr, "%s %d: %s\n", level_names[level], code, msg);
+    else
+      fprintf(stderr, "%s: %s\n", level_names[level], msg);
+    return;
+  }
+
+  ring_t *ring = acquire_ring();
+  if (!ring) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= RING_SLOTS) {
+    atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  event_t *event = &ring->slots[head & (RING_SLOTS - 1)];
+  clock_gettime(CLOCK_REALTIME, &event->ts);
+  event->level = level;
+  event->code = code;
+  event->tid = local_tid;
+  memcpy(event->op, local_op, OP_LENGTH);
+
+  va_start(args, fmt);
+  vsnprintf(event->msg, MSG_LENGTH, fmt, args);
+  va_end(args);
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static void write_json_string(const char *text) {
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(out, "\\%c", *c);
+    else if (*c < 0x20)
+      fprintf(out, "\\u%04x", *c);
+    else
+      fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+static void write_event(const event_t *event) {
+  int level = event->level;
+  if (level < FM_LOG_DEBUG_LEVEL || level > FM_LOG_ERROR_LEVEL)
+    level = FM_LOG_ERROR_LEVEL;
+
+  fprintf(out, "{\"ts\":%lld.%09ld,\"level\":\"%s\",\"tid\":%u",
+          (long long)event->ts.tv_sec, event->ts.tv_nsec, level_names[level],
+          event->tid);
+  if (event->code != 0)
+    fprintf(out, ",\"code\":%d", event->code);
+  if (event->op[0]) {
+    fputs(",\"op\":", out);
+    write_json_string(event->op);
+  }
+  fputs(",\"msg\":", out);
+  write_json_string(event->msg);
+  fputs("}\n", out);
+}
+
+static void drain(void) {
+  for (ring_t *ring = atomic_load(&rings); ring; ring = ring->next) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; tail++)
+      write_event(&ring->slots[tail & (RING_SLOTS - 1)]);
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+
+  size_t lost = atomic_exchange(&dropped, 0);
+  if (lost > 0)
+    fprintf(out, "{\"level\":\"warn\",\"msg\":\"dropped %zu events\"}\n", lost);
+  fflush(out);
+}
+
+static void *writer_main(void *arg) {
+  (void)arg;
+  struct timespec interval = {0, WRITER_INTERVAL_NS};
+  while (!atomic_load(&stop_writer)) {
+    drain();
+    nanosleep(&interval, NULL);
+  }
+  return NULL;
+}
+
+int event_log_open(const char *path) {
+  if (out)
+    return FM_SUCCESS;
+
+  out = fopen(path, "a");
+  if (!out)
+    return FM_ERR_SYSTEM;
+
+  atomic_store(&stop_writer, 0);
+  if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+    fclose(out);
+    out = NULL;
+    return FM_ERR_SYSTEM;
+  }
+  atomic_store_explicit(&writing, 1, memory_order_release);
+
+  if (!registered_atexit) {
+    atexit(event_log_close);
+    registered_atexit = 1;
+  }
+  return FM_SUCCESS;
+}
+
+void event_log_close(void) {
+  if (!out)
+    return;
+
+  // Later events go to stderr; anything already queued is drained below
+  atomic_store(&writing, 0);
+  atomic_store(&stop_writer, 1);
+  pthread_join(writer, NULL);
+  drain();
+  fclose(out);
+  out = NULL;
+}
@@ -1,12 +1,18 @@
 // src/file_manager.c
 #include "file_manager.h"
+#include "batch_journal.h"
+#include "checksum.h"
 #include "common.h"
+#include "cow_clone.h"
 #include "db_manager.h"
+#include "delta.h"
 #include "error_handler.h"
+#include "event_log.h"
 #include "json_object.h"
 #include "json_tokener.h"
 #include "json_types.h"
 #include <fcntl.h>
+#include <inttypes.h>
 #include <json-c/json.h>
 #include <openssl/evp.h>
 #include <stdbool.h>
@@ -18,49 +24,93 @@
 
 static char root_path[MAX_PATH_LENGTH] = "/home/o/Public";
 
-static int calculate_checksum(const char *file_path, char *checksum) {
-  unsigned char hash[EVP_MAX_MD_SIZE];
-  unsigned char buffer[BUFFER_SIZE];
-  FILE *file = fopen(file_path, "rb");
-  if (!file)
-    return FM_ERR_NOT_FOUND;
-
-  EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-  const EVP_MD *md = EVP_sha256();
-  if (!ctx) {
-    fprintf(stderr, "Error creating context\n");
-    return 1;
+// Algorithm used for new checksums, as recorded in the catalog at init
+static checksum_algo_t store_checksum_algo(void) {
+  static int loaded = 0;
+  static checksum_algo_t algo = CHECKSUM_DEFAULT_ALGO;
+  if (!loaded) {
+    char name[16];
+    if (db_get_setting("checksum_algo", name, sizeof(name)) == FM_SUCCESS)
+      checksum_algo_from_name(name, &algo);
+    loaded = 1;
   }
+  return algo;
+}
 
-  if (EVP_DigestInit_ex(ctx, md, NULL) != 1) {
-    fprintf(stderr, "Error initializing digest\n");
-    EVP_MD_CTX_free(ctx);
-    return 1;
+// Whether the store opted into chunked checksums at init; off by default,
+// so the checksum column stays a plain digest of the file
+static int store_chunked_checksums(void) {
+  static int loaded = 0;
+  static int chunked = 0;
+  if (!loaded) {
+    char value[8];
+    if (db_get_setting("chunked_checksums", value, sizeof(value)) ==
+        FM_SUCCESS)
+      chunked = strcmp(value, "1") == 0;
+    loaded = 1;
   }
+  return chunked;
+}
 
-  size_t bytes;
-  while ((bytes = fread(buffer, 1, BUFFER_SIZE, file)) != 0) {
-    if (EVP_DigestUpdate(ctx, buffer, bytes) != 1) {
-      fprintf(stderr, "Error updating digest\n");
-      EVP_MD_CTX_free(ctx);
-      return 1;
-    }
+// Checksum a file into info: a flat hash by default, or for large files in
+// stores with chunked checksums, a Merkle root over chunk hashes (computed
+// in parallel). When the row already has chunk hashes and dirty is given,
+// only dirty chunks are rehashed.
+static int calculate_checksum(const char *file_path, file_info_t *info,
+                              const unsigned char *dirty,
+                              chunk_list_t *chunks) {
+  struct stat st;
+  if (stat(file_path, &st) != 0)
+    return FM_ERR_NOT_FOUND;
+
+  checksum_algo_t algo = store_checksum_algo();
+  checksum_algo_t row_algo;
+  int same_algo =
+      checksum_algo_from_name(info->checksum_algo, &row_algo) == FM_SUCCESS &&
+      row_algo == algo;
+  strncpy(info->checksum_algo, checksum_algo_name(algo),
+          sizeof(info->checksum_algo) - 1);
+
+  if (!store_chunked_checksums() ||
+      (size_t)st.st_size < CHECKSUM_CHUNKED_MIN_SIZE) {
+    // Leftover chunk hashes of the row are cleared by store_chunks
+    chunks->chunk_size = info->chunk_size;
+    chunks->count = 0;
+    info->chunk_size = 0;
+    return checksum_file(file_path, algo, info->checksum);
   }
 
-  uint32_t hashlen = 0;
-  if (EVP_DigestFinal_ex(ctx, hash, &hashlen) != 1) {
-    fprintf(stderr, "Error updating digest\n");
-    EVP_MD_CTX_free(ctx);
-    return 1;
+  if (dirty && same_algo && info->id && info->chunk_size &&
+      db_load_chunks(info->id, chunks) == FM_SUCCESS && chunks->count > 0) {
+    chunks->chunk_size = info->chunk_size;
+    return checksum_rehash_chunks(file_path, algo, chunks, dirty,
+                                  info->checksum);
   }
-  EVP_MD_CTX_free(ctx);
-  fclose(file);
 
-  for (uint32_t i = 0; i < hashlen; i++) {
-    sprintf(checksum + (i * 2), "%02x", hash[i]);
+  checksum_free_chunks(chunks);
+  info->chunk_size = CHECKSUM_CHUNK_SIZE;
+  return checksum_file_chunked(file_path, algo, CHECKSUM_CHUNK_SIZE, chunks,
+                               info->checksum);
+}
+
+// Write the chunk hashes for the row at path once the row itself has been
+// written (result is the status of that write)
+static int store_chunks(int result, const char *path, chunk_list_t *chunks) {
+  if (result == FM_SUCCESS && chunks->chunk_size) {
+    file_info_t info;
+    memset(&info, 0, sizeof(info));
+    if (db_get_file_info(path, &info) == FM_SUCCESS && info.id)
+      result = db_save_chunks(info.id, chunks);
   }
-  checksum[64] = '\0';
-  return FM_SUCCESS;
+  checksum_free_chunks(chunks);
+  return result;
+}
+
+const char *fm_get_base_file_name(const char *path) {
+  const char *lastslash = strrchr(path, '/');
+  if (!lastslash)
+    return path;
+  return lastslash + 1;
 }
 
 static int get_parent_path(const char *path, char *parent_path) {
@@ -79,7 +129,9 @@ static int get_parent_path(const char *path, char *parent_path) {
   return FM_SUCCESS;
 }
 
-int fm_init(const char *base_path) {
+const char *fm_get_root_path(void) { return root_path; }
+
+int fm_init(const char *base_path, const char *checksum_algo, int chunked) {
   strncpy(root_path, base_path, MAX_PATH_LENGTH);
   root_path[MAX_PATH_LENGTH - 1] = '\0';
 
@@ -95,7 +147,26 @@ int fm_init(const char *base_path) {
   // Initialize database
   char db_path[MAX_PATH_LENGTH];
   snprintf(db_path, MAX_PATH_LENGTH, "%s/filedb.sqlite", root_path);
-  return db_init(db_path);
+  int result = db_init(db_path);
+  if (result != FM_SUCCESS)
+    return result;
+
+  if (chunked >= 0 &&
+      db_set_setting("chunked_checksums", chunked ? "1" : "0") != FM_SUCCESS)
+    return FM_ERR_DB_ERROR;
+
+  // Record the store's checksum algorithm; rows keep their own tag, so
+  // switching later leaves existing checksums verifiable
+  char current[16];
+  if (!checksum_algo && db_get_setting("checksum_algo", current,
+                                       sizeof(current)) == FM_SUCCESS)
+    return FM_SUCCESS;
+
+  checksum_algo_t algo = CHECKSUM_DEFAULT_ALGO;
+  if (checksum_algo &&
+      checksum_algo_from_name(checksum_algo, &algo) != FM_SUCCESS)
+    return FM_ERR_INVALID_PATH;
+  return db_set_setting("checksum_algo", checksum_algo_name(algo));
 }
 
 int fm_create_file(const char *path, size_t size) {
@@ -133,17 +204,19 @@ int fm_create_file(const char *path, size_t size) {
   file_info.size = size;
 
   // Calculate checksum
-  calculate_checksum(full_path, file_info.checksum);
+  chunk_list_t chunks = {0};
+  calculate_checksum(full_path, &file_info, NULL, &chunks);
 
   // Get parent directory info
   char parent_path[MAX_PATH_LENGTH];
-  get_parent_path(path, parent_path);
   file_info_t parent_info;
-  if (db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
+  memset(&parent_info, 0, sizeof(parent_info));
+  if (get_parent_path(path, parent_path) == FM_SUCCESS &&
+      db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
     file_info.parent_id = parent_info.id;
   }
 
-  return db_insert_file(&file_info);
+  return store_chunks(db_insert_file(&file_info), path, &chunks);
 }
 
 int fm_create_directory(const char *path) {
@@ -176,9 +249,10 @@ int fm_create_directory(const char *path) {
 
   // Get parent directory info
   char parent_path[MAX_PATH_LENGTH];
-  get_parent_path(path, parent_path);
   file_info_t parent_info;
-  if (db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
+  memset(&parent_info, 0, sizeof(parent_info));
+  if (get_parent_path(path, parent_path) == FM_SUCCESS &&
+      db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
     dir_info.parent_id = parent_info.id;
   }
 
@@ -228,17 +302,19 @@ int fm_copy(const char *src, const char *dest) {
   strncpy(dest_info.name, name, MAX_NAME_LENGTH - 1);
   strncpy(dest_info.path, dest, MAX_PATH_LENGTH - 1);
 
-  calculate_checksum(full_dest, dest_info.checksum);
+  chunk_list_t chunks = {0};
+  calculate_checksum(full_dest, &dest_info, NULL, &chunks);
 
   // Get parent directory info for destination
   char parent_path[MAX_PATH_LENGTH];
-  get_parent_path(dest, parent_path);
   file_info_t parent_info;
-  if (db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
+  memset(&parent_info, 0, sizeof(parent_info));
+  if (get_parent_path(dest, parent_path) == FM_SUCCESS &&
+      db_get_file_info(parent_path, &parent_info) == FM_SUCCESS) {
     dest_info.parent_id = parent_info.id;
   }
 
-  return db_insert_file(&dest_info);
+  return store_chunks(db_insert_file(&dest_info), dest, &chunks);
 }
 
 int fm_rename(const char *old_path, const char *new_path) {
@@ -262,11 +338,12 @@ int fm_rename(const char *old_path, const char *new_path) {
   strncpy(file_info.name, name, MAX_NAME_LENGTH - 1);
   strncpy(file_info.path, new_path, MAX_PATH_LENGTH - 1);
 
+  chunk_list_t chunks = {0};
   if (strcmp(file_info.type, FILE_TYPE_FILE) == 0) {
-    calculate_checksum(full_new, file_info.checksum);
+    calculate_checksum(full_new, &file_info, NULL, &chunks);
   }
 
-  return db_update_file(&file_info);
+  return store_chunks(db_update_file(&file_info), new_path, &chunks);
 }
 
 int fm_delete(const char *path) {
@@ -311,6 +388,589 @@ int fm_delete(const char *path) {
   return db_delete_file(path);
 }
 
+static int same_mtime(const struct stat *a, const struct stat *b) {
+  return a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void copy_mtime(const char *full_path, const struct stat *from) {
+  struct timespec times[2] = {from->st_atim, from->st_mtim};
+  utimensat(AT_FDCWD, full_path, times, 0);
+}
+
+// chmod does not touch the mtime, so a mode change alone must be synced
+// even when the contents are skipped or patched in place
+static void copy_mode(const char *full_path, const struct stat *from,
+                      const struct stat *to) {
+  if ((from->st_mode & 0777) != (to->st_mode & 0777))
+    chmod(full_path, from->st_mode & 0777);
+}
+
+// A row written before the file last changed describes older contents;
+// the file was modified behind the catalog
+static int row_is_current(const file_info_t *info, const struct stat *st) {
+  return info->modified_at >= st->st_mtime;
+}
+
+// Stored checksums are only trusted when both rows are current
+static int catalog_checksums_match(const char *src, const struct stat *src_st,
+                                   const char *dest,
+                                   const struct stat *dest_st) {
+  file_info_t src_info, dest_info;
+  memset(&src_info, 0, sizeof(src_info));
+  memset(&dest_info, 0, sizeof(dest_info));
+  if (db_get_file_info(src, &src_info) != FM_SUCCESS ||
+      db_get_file_info(dest, &dest_info) != FM_SUCCESS)
+    return 0;
+  if (!src_info.checksum[0] || !dest_info.checksum[0])
+    return 0;
+  checksum_algo_t src_algo, dest_algo;
+  if (checksum_algo_from_name(src_info.checksum_algo, &src_algo) !=
+          FM_SUCCESS ||
+      checksum_algo_from_name(dest_info.checksum_algo, &dest_algo) !=
+          FM_SUCCESS ||
+      src_algo != dest_algo || src_info.chunk_size != dest_info.chunk_size)
+    return 0;
+  if (!row_is_current(&src_info, src_st) ||
+      !row_is_current(&dest_info, dest_st))
+    return 0;
+  return strcmp(src_info.checksum, dest_info.checksum) == 0;
+}
+
+static int copy_file_contents(const char *full_src, const char *full_dest,
+                              mode_t mode, sync_stats_t *stats) {
+  FILE *source = fopen(full_src, "rb");
+  FILE *destination = fopen(full_dest, "wb");
+  if (!source || !destination) {
+    if (source)
+      fclose(source);
+    if (destination)
+      fclose(destination);
+    error_log(FM_ERR_SYSTEM, "Failed to open files for copy");
+    return FM_ERR_SYSTEM;
+  }
+
+  char buffer[BUFFER_SIZE];
+  size_t bytes;
+  int result = FM_SUCCESS;
+  while ((bytes = fread(buffer, 1, BUFFER_SIZE, source)) != 0) {
+    if (fwrite(buffer, 1, bytes, destination) != bytes) {
+      error_log(FM_ERR_SYSTEM, "Failed to write destination file");
+      result = FM_ERR_SYSTEM;
+      break;
+    }
+    stats->bytes_literal += bytes;
+  }
+
+  fclose(source);
+  if (fclose(destination) != 0)
+    result = FM_ERR_SYSTEM;
+  chmod(full_dest, mode & 0777);
+  return result;
+}
+
+// Flag the chunks of a file that overlap the changed ranges
+static unsigned char *dirty_chunks(const delta_ranges_t *changed,
+                                   size_t chunk_size, size_t size) {
+  size_t count = (size + chunk_size - 1) / chunk_size;
+  unsigned char *dirty = calloc(count ? count : 1, 1);
+  if (!dirty)
+    return NULL;
+  for (size_t i = 0; i < changed->count; i++) {
+    const delta_range_t *range = &changed->items[i];
+    size_t last = (range->offset + range->length - 1) / chunk_size;
+    for (size_t c = range->offset / chunk_size; c <= last && c < count; c++)
+      dirty[c] = 1;
+  }
+  return dirty;
+}
+
+// Insert or refresh the catalog row for a path written by sync. changed,
+// when known, limits rehashing of chunked checksums to modified chunks.
+static int sync_catalog_entry(const char *path, const char *full_path,
+                              const char *type, size_t size,
+                              const delta_ranges_t *changed) {
+  file_info_t info;
+  memset(&info, 0, sizeof(info));
+  db_get_file_info(path, &info);
+  int exists = info.id != 0;
+  if (exists && strcmp(type, FILE_TYPE_DIRECTORY) == 0)
+    return FM_SUCCESS;
+
+  strncpy(info.name, fm_get_base_file_name(path), MAX_NAME_LENGTH - 1);
+  strncpy(info.path, path, MAX_PATH_LENGTH - 1);
+  strncpy(info.type, type, sizeof(info.type) - 1);
+  info.size = size;
+
+  chunk_list_t chunks = {0};
+  if (strcmp(type, FILE_TYPE_FILE) == 0) {
+    unsigned char *dirty = NULL;
+    if (changed && info.chunk_size)
+      dirty = dirty_chunks(changed, info.chunk_size, size);
+    calculate_checksum(full_path, &info, dirty, &chunks);
+    free(dirty);
+  }
+
+  if (exists)
+    return store_chunks(db_update_file(&info), path, &chunks);
+
+  char parent_path[MAX_PATH_LENGTH];
+  file_info_t parent_info;
+  memset(&parent_info, 0, sizeof(parent_info));
+  if (get_parent_path(path, parent_path) == FM_SUCCESS &&
+      db_get_file_info(parent_path, &parent_info) == FM_SUCCESS)
+    info.parent_id = parent_info.id;
+  return store_chunks(db_insert_file(&info), path, &chunks);
+}
+
+static int sync_file(const char *src, const char *dest,
+                     const struct stat *src_st, sync_stats_t *stats) {
+  char full_src[MAX_PATH_LENGTH], full_dest[MAX_PATH_LENGTH];
+  snprintf(full_src, MAX_PATH_LENGTH, "%s/%s", root_path, src);
+  snprintf(full_dest, MAX_PATH_LENGTH, "%s/%s", root_path, dest);
+
+  stats->files_scanned++;
+  struct stat dest_st;
+  int dest_exists = stat(full_dest, &dest_st) == 0;
+  if (dest_exists && S_ISDIR(dest_st.st_mode)) {
+    error_log(FM_ERR_ALREADY_EXISTS, "Sync target is a directory");
+    return FM_ERR_ALREADY_EXISTS;
+  }
+
+  if (dest_exists && dest_st.st_size == src_st->st_size) {
+    if (same_mtime(src_st, &dest_st)) {
+      copy_mode(full_dest, src_st, &dest_st);
+      stats->files_skipped++;
+      return FM_SUCCESS;
+    }
+    if (catalog_checksums_match(src, src_st, dest, &dest_st)) {
+      copy_mode(full_dest, src_st, &dest_st);
+      copy_mtime(full_dest, src_st);
+      stats->files_skipped++;
+      return FM_SUCCESS;
+    }
+  }
+
+  int result;
+  delta_ranges_t changed = {0};
+  int have_changed = 0;
+  if (dest_exists && (size_t)dest_st.st_size >= DELTA_MIN_SIZE) {
+    result = delta_sync_file(full_src, full_dest, stats, &changed);
+    if (result == FM_SUCCESS)
+      copy_mode(full_dest, src_st, &dest_st);
+    // The changed ranges are relative to the old on-disk dest; its stored
+    // chunk hashes can only be reused if they were taken from that content
+    file_info_t dest_info;
+    memset(&dest_info, 0, sizeof(dest_info));
+    have_changed = result == FM_SUCCESS &&
+                   db_get_file_info(dest, &dest_info) == FM_SUCCESS &&
+                   dest_info.id && row_is_current(&dest_info, &dest_st);
+    stats->files_delta++;
+  } else {
+    result = copy_file_contents(full_src, full_dest, src_st->st_mode, stats);
+    stats->files_copied++;
+  }
+  if (result != FM_SUCCESS)
+    return result;
+
+  copy_mtime(full_dest, src_st);
+  result = sync_catalog_entry(dest, full_dest, FILE_TYPE_FILE, src_st->st_size,
+                              have_changed ? &changed : NULL);
+  free(changed.items);
+  return result;
+}
+
+// Remove entries of dest that no longer exist under src
+static int sync_prune(const char *src, const char *dest, sync_stats_t *stats) {
+  char full_dest[MAX_PATH_LENGTH];
+  snprintf(full_dest, MAX_PATH_LENGTH, "%s/%s", root_path, dest);
+
+  DIR *dir = opendir(full_dest);
+  if (!dir)
+    return FM_ERR_SYSTEM;
+
+  int result = FM_SUCCESS;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    char full_src_entry[MAX_PATH_LENGTH], dest_entry[MAX_PATH_LENGTH];
+    snprintf(full_src_entry, MAX_PATH_LENGTH, "%s/%s/%s", root_path, src,
+             entry->d_name);
+    struct stat st;
+    if (lstat(full_src_entry, &st) == 0 || errno != ENOENT)
+      continue;
+
+    snprintf(dest_entry, MAX_PATH_LENGTH, "%s/%s", dest, entry->d_name);
+    result = fm_delete(dest_entry);
+    if (result != FM_SUCCESS)
+      break;
+    stats->files_deleted++;
+  }
+  closedir(dir);
+  return result;
+}
+
+static int sync_tree(const char *src, const char *dest, int propagate_delete,
+                     sync_stats_t *stats) {
+  char full_src[MAX_PATH_LENGTH], full_dest[MAX_PATH_LENGTH];
+  snprintf(full_src, MAX_PATH_LENGTH, "%s/%s", root_path, src);
+  snprintf(full_dest, MAX_PATH_LENGTH, "%s/%s", root_path, dest);
+
+  struct stat st;
+  if (lstat(full_src, &st) != 0)
+    return FM_ERR_NOT_FOUND;
+  if (S_ISREG(st.st_mode))
+    return sync_file(src, dest, &st, stats);
+  if (!S_ISDIR(st.st_mode))
+    return FM_SUCCESS; // special files and symlinks are not managed
+
+  struct stat dest_st;
+  if (stat(full_dest, &dest_st) != 0) {
+    if (mkdir(full_dest, st.st_mode & 0777) != 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to create directory");
+      return FM_ERR_SYSTEM;
+    }
+  } else if (!S_ISDIR(dest_st.st_mode)) {
+    error_log(FM_ERR_ALREADY_EXISTS, "Sync target is not a directory");
+    return FM_ERR_ALREADY_EXISTS;
+  }
+  int result =
+      sync_catalog_entry(dest, full_dest, FILE_TYPE_DIRECTORY, 0, NULL);
+  if (result != FM_SUCCESS)
+    return result;
+
+  DIR *dir = opendir(full_src);
+  if (!dir)
+    return FM_ERR_SYSTEM;
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    char src_entry[MAX_PATH_LENGTH], dest_entry[MAX_PATH_LENGTH];
+    snprintf(src_entry, MAX_PATH_LENGTH, "%s/%s", src, entry->d_name);
+    snprintf(dest_entry, MAX_PATH_LENGTH, "%s/%s", dest, entry->d_name);
+    result = sync_tree(src_entry, dest_entry, propagate_delete, stats);
+    if (result != FM_SUCCESS)
+      break;
+  }
+  closedir(dir);
+
+  if (result == FM_SUCCESS && propagate_delete)
+    result = sync_prune(src, dest, stats);
+  return result;
+}
+
+// Copy path without trailing slashes; "" stands for the store root
+static void sync_root_path(const char *path, char *out) {
+  strncpy(out, path, MAX_PATH_LENGTH - 1);
+  out[MAX_PATH_LENGTH - 1] = '\0';
+  size_t len = strlen(out);
+  while (len > 0 && out[len - 1] == '/')
+    out[--len] = '\0';
+  if (strcmp(out, ".") == 0)
+    out[0] = '\0';
+}
+
+// Whether inner is outer itself or lies somewhere below it
+static int path_within(const char *outer, const char *inner) {
+  size_t len = strlen(outer);
+  return len == 0 || (strncmp(outer, inner, len) == 0 &&
+                      (inner[len] == '\0' || inner[len] == '/'));
+}
+
+int fm_sync(const char *src, const char *dest, int propagate_delete,
+            sync_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  // The store root holds the catalog and every other tree; pruning it
+  // would delete them
+  char sync_src[MAX_PATH_LENGTH], sync_dest[MAX_PATH_LENGTH];
+  sync_root_path(src, sync_src);
+  sync_root_path(dest, sync_dest);
+  if (sync_dest[0] == '\0') {
+    error_log(FM_ERR_INVALID_PATH, "Cannot sync onto the store root");
+    return FM_ERR_INVALID_PATH;
+  }
+
+  // Syncing a tree into itself would never terminate, and syncing it into
+  // one of its ancestors would prune the source with --delete
+  if (path_within(sync_src, sync_dest)) {
+    error_log(FM_ERR_INVALID_PATH, "Sync destination is inside the source");
+    return FM_ERR_INVALID_PATH;
+  }
+  if (path_within(sync_dest, sync_src)) {
+    error_log(FM_ERR_INVALID_PATH, "Sync source is inside the destination");
+    return FM_ERR_INVALID_PATH;
+  }
+
+  return sync_tree(sync_src, sync_dest, propagate_delete, stats);
+}
+
+int fm_verify(const char *path, size_t **bad, size_t *bad_count) {
+  char full_path[MAX_PATH_LENGTH];
+  snprintf(full_path, MAX_PATH_LENGTH, "%s/%s", root_path, path);
+  *bad = NULL;
+  *bad_count = 0;
+
+  file_info_t info;
+  memset(&info, 0, sizeof(info));
+  if (db_get_file_info(path, &info) != FM_SUCCESS || !info.id ||
+      strcmp(info.type, FILE_TYPE_FILE) != 0)
+    return FM_ERR_NOT_FOUND;
+
+  // Verify with the algorithm the row was hashed with, not the store default
+  checksum_algo_t algo;
+  if (checksum_algo_from_name(info.checksum_algo, &algo) != FM_SUCCESS)
+    return FM_ERR_INVALID_PATH;
+
+  if (info.chunk_size) {
+    chunk_list_t chunks = {0};
+    int result = db_load_chunks(info.id, &chunks);
+    chunks.chunk_size = info.chunk_size;
+    if (result == FM_SUCCESS)
+      result =
+          checksum_verify_chunks(full_path, algo, &chunks, bad, bad_count);
+    checksum_free_chunks(&chunks);
+    return result;
+  }
+
+  // A flat checksum can only tell that something changed: report chunk 0
+  char checksum[65];
+  int result = checksum_file(full_path, algo, checksum);
+  if (result != FM_SUCCESS)
+    return result;
+  if (strcmp(checksum, info.checksum) != 0) {
+    *bad = malloc(sizeof(size_t));
+    if (!*bad)
+      return FM_ERR_SYSTEM;
+    (*bad)[0] = 0;
+    *bad_count = 1;
+  }
+  return FM_SUCCESS;
+}
+
+int fm_gc(int retention_days, int archive, int archive_days, int convert,
+          size_t *purged, size_t *archive_purged) {
+  int result = db_purge_deleted(retention_days, archive, purged);
+  if (result == FM_SUCCESS)
+    result = db_purge_archive(archive_days, archive_purged);
+  if (result != FM_SUCCESS)
+    return result;
+  return db_vacuum(convert, *purged > 0 || *archive_purged > 0);
+}
+
+// Snapshot names become a path component and a catalog key
+static int dirsnap_valid_name(const char *name) {
+  return name[0] && strlen(name) < MAX_NAME_LENGTH && !strchr(name, '/') &&
+         !strchr(name, '\'') && strcmp(name, ".") != 0 &&
+         strcmp(name, "..") != 0;
+}
+
+static int dirsnap_paths(const char *name, char *snap_path, char *full_snap) {
+  if (!dirsnap_valid_name(name)) {
+    error_log(FM_ERR_INVALID_PATH, "Invalid snapshot name");
+    return FM_ERR_INVALID_PATH;
+  }
+  snprintf(snap_path, MAX_PATH_LENGTH, "%s/%s", FM_DIRSNAP_DIR, name);
+  snprintf(full_snap, MAX_PATH_LENGTH, "%s/%s", root_path, snap_path);
+  return FM_SUCCESS;
+}
+
+static int dirsnap_parent_id(const char *path) {
+  char parent_path[MAX_PATH_LENGTH];
+  file_info_t parent_info;
+  memset(&parent_info, 0, sizeof(parent_info));
+  if (get_parent_path(path, parent_path) == FM_SUCCESS)
+    db_get_file_info(parent_path, &parent_info);
+  return parent_info.id;
+}
+
+int fm_dirsnap_create(const char *dir, const char *name, int allow_copy) {
+  char path[MAX_PATH_LENGTH];
+  strncpy(path, dir, MAX_PATH_LENGTH - 1);
+  path[MAX_PATH_LENGTH - 1] = '\0';
+  size_t len = strlen(path);
+  while (len > 0 && path[len - 1] == '/')
+    path[--len] = '\0';
+
+  // The store root would contain its own snapshots
+  size_t snap_dir_len = strlen(FM_DIRSNAP_DIR);
+  if (len == 0 || strcmp(path, ".") == 0 || strchr(path, '\'') ||
+      (strncmp(path, FM_DIRSNAP_DIR, snap_dir_len) == 0 &&
+       (path[snap_dir_len] == '\0' || path[snap_dir_len] == '/'))) {
+    error_log(FM_ERR_INVALID_PATH, "Directory cannot be snapshotted");
+    return FM_ERR_INVALID_PATH;
+  }
+
+  char snap_path[MAX_PATH_LENGTH], full_snap[MAX_PATH_LENGTH];
+  int result = dirsnap_paths(name, snap_path, full_snap);
+  if (result != FM_SUCCESS)
+    return result;
+
+  dirsnap_info_t snap;
+  result = db_dirsnap_get(name, &snap);
+  if (result == FM_SUCCESS) {
+    error_log(FM_ERR_ALREADY_EXISTS, "Snapshot already exists");
+    return FM_ERR_ALREADY_EXISTS;
+  }
+  if (result != FM_ERR_NOT_FOUND)
+    return result;
+
+  // Snapshots are catalogued under FM_DIRSNAP_DIR, so list and info work
+  // on them like on any other directory
+  char full_snap_dir[MAX_PATH_LENGTH];
+  snprintf(full_snap_dir, MAX_PATH_LENGTH, "%s/%s", root_path,
+           FM_DIRSNAP_DIR);
+  struct stat st;
+  if (stat(full_snap_dir, &st) != 0 &&
+      (result = fm_create_directory(FM_DIRSNAP_DIR)) != FM_SUCCESS)
+    return result;
+  file_info_t snap_dir_info;
+  memset(&snap_dir_info, 0, sizeof(snap_dir_info));
+  db_get_file_info(FM_DIRSNAP_DIR, &snap_dir_info);
+
+  char full_path[MAX_PATH_LENGTH];
+  snprintf(full_path, MAX_PATH_LENGTH, "%s/%s", root_path, path);
+  cow_method_t method;
+  result = cow_clone_tree(full_path, full_snap, 1, allow_copy, &method);
+  if (result == FM_ERR_PERMISSION)
+    error_log(FM_ERR_PERMISSION,
+              "Snapshots need reflink or btrfs subvolume support; "
+              "allow a full copy explicitly to snapshot anyway");
+  if (result != FM_SUCCESS)
+    return result;
+
+  memset(&snap, 0, sizeof(snap));
+  strncpy(snap.name, name, MAX_NAME_LENGTH - 1);
+  strncpy(snap.source, path, MAX_PATH_LENGTH - 1);
+  strncpy(snap.method, cow_method_name(method), sizeof(snap.method) - 1);
+  result = db_clone_tree(path, snap_path, snap_dir_info.id, &snap.entries);
+  if (result == FM_SUCCESS)
+    result = db_dirsnap_add(&snap);
+  if (result != FM_SUCCESS) {
+    db_remove_tree(snap_path);
+    cow_remove_tree(full_snap);
+    return result;
+  }
+
+  FM_LOG_INFO("snapshot %s of %s: %s, %zu catalog entries", name, path,
+              snap.method, snap.entries);
+  return FM_SUCCESS;
+}
+
+int fm_dirsnap_list(dirsnap_list_t *list) { return db_dirsnap_list(list); }
+
+int fm_dirsnap_check(const char *dir, const char **method) {
+  char full_path[MAX_PATH_LENGTH];
+  snprintf(full_path, MAX_PATH_LENGTH, "%s/%s", root_path, dir);
+  cow_method_t best;
+  int result = cow_probe(full_path, &best);
+  if (result != FM_SUCCESS)
+    return result;
+  *method = cow_method_name(best);
+  if (best == COW_METHOD_COPY) {
+    error_log(FM_ERR_PERMISSION, "No copy-on-write support on this filesystem");
+    return FM_ERR_PERMISSION;
+  }
+  return FM_SUCCESS;
+}
+
+int fm_dirsnap_restore(const char *name) {
+  char snap_path[MAX_PATH_LENGTH], full_snap[MAX_PATH_LENGTH];
+  int result = dirsnap_paths(name, snap_path, full_snap);
+  if (result != FM_SUCCESS)
+    return result;
+
+  dirsnap_info_t snap;
+  if ((result = db_dirsnap_get(name, &snap)) != FM_SUCCESS) {
+    if (result == FM_ERR_NOT_FOUND)
+      error_log(FM_ERR_NOT_FOUND, "Unknown snapshot");
+    return result;
+  }
+
+  char full_path[MAX_PATH_LENGTH], staged[MAX_PATH_LENGTH + 16];
+  snprintf(full_path, MAX_PATH_LENGTH, "%s/%s", root_path, snap.source);
+  snprintf(staged, sizeof(staged), "%s.fmrestore", full_path);
+
+  // Never delete a path fm did not just create: a leftover may be the
+  // previous contents kept by a restore whose catalog update failed
+  struct stat st;
+  if (lstat(staged, &st) == 0) {
+    char message[MAX_PATH_LENGTH + 64];
+    snprintf(message, sizeof(message), "%s already exists; remove it first",
+             staged);
+    error_log(FM_ERR_ALREADY_EXISTS, message);
+    return FM_ERR_ALREADY_EXISTS;
+  }
+
+  // Clone next to the directory, then exchange the two in one rename, so
+  // the path always names either the old tree or the restored one
+  cow_method_t method;
+  // A snapshot that was taken as a copy can only be restored as one
+  result = cow_clone_tree(full_snap, staged, 0,
+                          strcmp(snap.method, "copy") == 0, &method);
+  if (result != FM_SUCCESS)
+    return result;
+  int existed = stat(full_path, &st) == 0;
+  int swapped = existed ? renameat2(AT_FDCWD, staged, AT_FDCWD, full_path,
+                                    RENAME_EXCHANGE) == 0
+                        : rename(staged, full_path) == 0;
+  if (!swapped) {
+    error_log(FM_ERR_SYSTEM, "Failed to swap in restored directory");
+    cow_remove_tree(staged);
+    return FM_ERR_SYSTEM;
+  }
+
+  // staged now holds the previous contents (if any); they are only dropped
+  // once the catalog describes the restored tree
+  size_t entries;
+  result = db_clone_tree(snap_path, snap.source, dirsnap_parent_id(snap.source),
+                         &entries);
+  if (result != FM_SUCCESS) {
+    int undone = existed ? renameat2(AT_FDCWD, staged, AT_FDCWD, full_path,
+                                     RENAME_EXCHANGE) == 0
+                         : rename(full_path, staged) == 0;
+    if (!undone) {
+      char message[MAX_PATH_LENGTH + 64];
+      snprintf(message, sizeof(message),
+               "Catalog update failed; previous contents are in %s", staged);
+      error_log(FM_ERR_SYSTEM, message);
+      return result;
+    }
+    cow_remove_tree(staged);
+    return result;
+  }
+
+  if (cow_remove_tree(staged) != FM_SUCCESS)
+    FM_LOG_WARN("could not remove %s", staged);
+  FM_LOG_INFO("restored %s from snapshot %s: %s, %zu catalog entries",
+              snap.source, name, cow_method_name(method), entries);
+  return FM_SUCCESS;
+}
+
+int fm_dirsnap_drop(const char *name) {
+  char snap_path[MAX_PATH_LENGTH], full_snap[MAX_PATH_LENGTH];
+  int result = dirsnap_paths(name, snap_path, full_snap);
+  if (result != FM_SUCCESS)
+    return result;
+
+  dirsnap_info_t snap;
+  if ((result = db_dirsnap_get(name, &snap)) != FM_SUCCESS) {
+    if (result == FM_ERR_NOT_FOUND)
+      error_log(FM_ERR_NOT_FOUND, "Unknown snapshot");
+    return result;
+  }
+
+  if ((result = cow_remove_tree(full_snap)) != FM_SUCCESS ||
+      (result = db_remove_tree(snap_path)) != FM_SUCCESS)
+    return result;
+  return db_dirsnap_remove(name);
+}
+
 int fm_get_file_info(const char *path, file_info_t *info) {
   return db_get_file_info(path, info);
 }
@@ -321,6 +981,10 @@ int fm_list_directory(const char *path, file_list_t *list) {
 
 char *file_string(const char *json_file) {
   FILE *f = fopen(json_file, "r");
+  if (!f) {
+    error_log(FM_ERR_NOT_FOUND, "Failed to open batch file");
+    return NULL;
+  }
   fseek(f, 0, SEEK_END);
   long file_size = ftell(f);
   fseek(f, 0, SEEK_SET);
@@ -334,54 +998,274 @@ char *file_string(const char *json_file) {
   return json_str;
 }
 
-const char *fm_get_base_file_name(const char *path) {
-  const char *lastslash = strrchr(path, '/');
-  if (!lastslash)
-    return path;
-  return lastslash + 1;
+// Batch copies run in process so progress can be checkpointed: every
+// BATCH_CHECKPOINT_BYTES the destination is synced and the offset journaled
+#define BATCH_COPY_BUFFER (1024 * 1024)
+#define BATCH_CHECKPOINT_BYTES (64ULL * 1024 * 1024)
+
+typedef struct {
+  batch_journal_t *journal;
+  size_t index;
+  size_t ops_done;
+  size_t op_count;
+  uint64_t bytes;
+  struct timespec started;
+  time_t last_report;
+  char *buffer;
+} batch_ctx_t;
+
+static void batch_report_progress(batch_ctx_t *ctx, int force) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!force && now.tv_sec == ctx->last_report)
+    return;
+  ctx->last_report = now.tv_sec;
+
+  double elapsed = (now.tv_sec - ctx->started.tv_sec) +
+                   (now.tv_nsec - ctx->started.tv_nsec) / 1e9;
+  double mib = ctx->bytes / (1024.0 * 1024.0);
+  double rate = elapsed > 0 ? mib / elapsed : 0;
+  if (isatty(STDERR_FILENO)) {
+    fprintf(stderr, "\r%zu/%zu entries, %.1f MiB, %.1f MiB/s%s", ctx->ops_done,
+            ctx->op_count, mib, rate, force ? "\n" : "");
+  } else {
+    FM_LOG_INFO("progress: %zu/%zu entries, %.1f MiB, %.1f MiB/s",
+                ctx->ops_done, ctx->op_count, mib, rate);
+  }
+}
+
+// A journaled offset is only reused if the destination still holds it and
+// the bytes just before it match the source
+static int batch_resume_valid(int src, int dest, uint64_t offset,
+                              char *buffer) {
+  struct stat st;
+  if (fstat(dest, &st) != 0 || (uint64_t)st.st_size < offset)
+    return 0;
+
+  size_t window = BATCH_COPY_BUFFER / 2;
+  if (offset < window)
+    window = offset;
+  off_t start = (off_t)(offset - window);
+  return pread(src, buffer, window, start) == (ssize_t)window &&
+         pread(dest, buffer + window, window, start) == (ssize_t)window &&
+         memcmp(buffer, buffer + window, window) == 0;
 }
 
-int fm_do_copy_inner(const char *from, char *to) {
+static int batch_checkpoint(batch_ctx_t *ctx, int dest, uint64_t offset,
+                            const char *full_dest) {
+  if (fdatasync(dest) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to sync destination file");
+    return FM_ERR_SYSTEM;
+  }
+  if (!ctx->journal)
+    return FM_SUCCESS;
+  return batch_journal_progress(ctx->journal, ctx->index, offset, full_dest);
+}
+
+static int batch_copy_file(batch_ctx_t *ctx, const char *full_src,
+                           const char *full_dest, const struct stat *src_st) {
+  // Finished by an earlier run: copies get the source mtime only at the end
+  struct stat dest_st;
+  if (lstat(full_dest, &dest_st) == 0 && S_ISREG(dest_st.st_mode) &&
+      dest_st.st_size == src_st->st_size && same_mtime(src_st, &dest_st))
+    return FM_SUCCESS;
+
+  int src = open(full_src, O_RDONLY);
+  int dest = open(full_dest, O_RDWR | O_CREAT, src_st->st_mode & 0777);
+  if (src < 0 || dest < 0) {
+    if (src >= 0)
+      close(src);
+    if (dest >= 0)
+      close(dest);
+    error_log(FM_ERR_SYSTEM, "Failed to open files for copy");
+    return FM_ERR_SYSTEM;
+  }
+
+  uint64_t offset =
+      ctx->journal ? batch_journal_offset(ctx->journal, ctx->index, full_dest)
+                   : 0;
+  if (offset && !batch_resume_valid(src, dest, offset, ctx->buffer)) {
+    FM_LOG_WARN("discarding checkpoint of %s", full_dest);
+    offset = 0;
+  }
+  if (offset)
+    FM_LOG_INFO("resuming %s at %" PRIu64, full_dest, offset);
+
+  int result = FM_SUCCESS;
+  if (ftruncate(dest, (off_t)offset) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to truncate destination file");
+    result = FM_ERR_SYSTEM;
+  }
+
+  uint64_t since_checkpoint = 0;
+  while (result == FM_SUCCESS) {
+    ssize_t bytes = pread(src, ctx->buffer, BATCH_COPY_BUFFER, (off_t)offset);
+    if (bytes < 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to read source file");
+      result = FM_ERR_SYSTEM;
+    }
+    if (bytes <= 0)
+      break;
+    if (pwrite(dest, ctx->buffer, bytes, (off_t)offset) != bytes) {
+      error_log(FM_ERR_SYSTEM, "Failed to write destination file");
+      result = FM_ERR_SYSTEM;
+      break;
+    }
+    offset += bytes;
+    ctx->bytes += bytes;
+    since_checkpoint += bytes;
+    if (since_checkpoint >= BATCH_CHECKPOINT_BYTES) {
+      result = batch_checkpoint(ctx, dest, offset, full_dest);
+      since_checkpoint = 0;
+    }
+    batch_report_progress(ctx, 0);
+  }
+
+  if (result == FM_SUCCESS && fdatasync(dest) != 0) {
+    error_log(FM_ERR_SYSTEM, "Failed to sync destination file");
+    result = FM_ERR_SYSTEM;
+  }
+  close(src);
+  if (close(dest) != 0 && result == FM_SUCCESS) {
+    error_log(FM_ERR_SYSTEM, "Failed to write destination file");
+    result = FM_ERR_SYSTEM;
+  }
+  if (result == FM_SUCCESS)
+    copy_mtime(full_dest, src_st);
+  return result;
+}
+
+static int batch_copy_tree(batch_ctx_t *ctx, const char *full_src,
+                           const char *full_dest) {
+  struct stat st;
+  if (lstat(full_src, &st) != 0) {
+    error_log(FM_ERR_NOT_FOUND, "Copy source does not exist");
+    return FM_ERR_NOT_FOUND;
+  }
+
+  if (S_ISREG(st.st_mode))
+    return batch_copy_file(ctx, full_src, full_dest, &st);
+
+  if (S_ISLNK(st.st_mode)) {
+    char target[MAX_PATH_LENGTH];
+    ssize_t len = readlink(full_src, target, sizeof(target) - 1);
+    if (len < 0) {
+      error_log(FM_ERR_SYSTEM, "Failed to read symlink");
+      return FM_ERR_SYSTEM;
+    }
+    target[len] = '\0';
+    if (symlink(target, full_dest) != 0 && errno != EEXIST) {
+      error_log(FM_ERR_SYSTEM, "Failed to create symlink");
+      return FM_ERR_SYSTEM;
+    }
+    return FM_SUCCESS;
+  }
+
+  if (!S_ISDIR(st.st_mode)) {
+    FM_LOG_WARN("skipping special file %s", full_src);
+    return FM_SUCCESS;
+  }
+
+  if (mkdir(full_dest, st.st_mode & 0777) != 0 && errno != EEXIST) {
+    error_log(FM_ERR_SYSTEM, "Failed to create directory");
+    return FM_ERR_SYSTEM;
+  }
+
+  DIR *dir = opendir(full_src);
+  if (!dir) {
+    error_log(FM_ERR_SYSTEM, "Failed to open directory");
+    return FM_ERR_SYSTEM;
+  }
+
+  int result = FM_SUCCESS;
+  struct dirent *entry;
+  while (result == FM_SUCCESS && (entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+    char child_src[MAX_PATH_LENGTH];
+    char child_dest[MAX_PATH_LENGTH];
+    snprintf(child_src, MAX_PATH_LENGTH, "%s/%s", full_src, entry->d_name);
+    snprintf(child_dest, MAX_PATH_LENGTH, "%s/%s", full_dest, entry->d_name);
+    result = batch_copy_tree(ctx, child_src, child_dest);
+  }
+  closedir(dir);
+  return result;
+}
+
+int fm_do_copy_inner(batch_ctx_t *ctx, const char *from, char *to) {
   struct stat from_stat, to_stat;
   if (stat(from, &from_stat) != 0) {
-    printf("file not exists\n");
-    return -1;
-  }
-  if (stat(to, &to_stat) == 0) {
-    if (S_ISDIR(to_stat.st_mode)) {
-      strcat(to, "/");
-      strcat(to, fm_get_base_file_name(from));
-    } else {
-      printf("can't copy to existed file\n");
-      return -1;
-    }
+    error_log(FM_ERR_NOT_FOUND, "Copy source does not exist");
+    return FM_ERR_NOT_FOUND;
   }
 
-  char cmd[2048];
-  sprintf(cmd, "cp -r %s %s", from, to);
-  printf("cmd: %s, <%s><%s>\n", cmd, from, to);
-  system(cmd);
+  // A resumed entry keeps the destination it resolved to the first time;
+  // by now that path exists and would otherwise be nested into or refused
+  const char *started =
+      ctx->journal ? batch_journal_dest(ctx->journal, ctx->index) : NULL;
+  if (started) {
+    strncpy(to, started, MAX_PATH_LENGTH - 1);
+    to[MAX_PATH_LENGTH - 1] = '\0';
+  } else {
+    if (stat(to, &to_stat) == 0) {
+      if (S_ISDIR(to_stat.st_mode)) {
+        strcat(to, "/");
+        strcat(to, fm_get_base_file_name(from));
+      } else {
+        error_log(FM_ERR_ALREADY_EXISTS, "Copy destination already exists");
+        return FM_ERR_ALREADY_EXISTS;
+      }
+    }
+    if (ctx->journal &&
+        batch_journal_started(ctx->journal, ctx->index, to) != FM_SUCCESS)
+      return FM_ERR_SYSTEM;
+  }
 
-  return 0;
+  return batch_copy_tree(ctx, from, to);
 }
 
-int fm_do_copy(const char *from, const char *to) {
-  char from_full[1024];
-  char to_full[1024];
-  sprintf(from_full, "%s/%s", root_path, from);
-  sprintf(to_full, "%s/%s", root_path, to);
+int fm_do_copy(batch_ctx_t *ctx, const char *from, const char *to) {
+  char from_full[MAX_PATH_LENGTH];
+  char to_full[MAX_PATH_LENGTH];
+  snprintf(from_full, MAX_PATH_LENGTH, "%s/%s", root_path, from);
+  snprintf(to_full, MAX_PATH_LENGTH, "%s/%s", root_path, to);
 
-  int res = fm_do_copy_inner(from_full, to_full);
-  printf("copy from %s to %s, result:%d\n", from_full, to_full, res);
+  int res = fm_do_copy_inner(ctx, from_full, to_full);
+  FM_LOG_DEBUG("copy from %s to %s, result:%d", from_full, to_full, res);
   return res;
 }
 
-int fm_batch_do_json_objet(struct json_object *json_obj) {
+// Keep the failure of one batch entry for the final report
+static void batch_record_error(batch_report_t *report, size_t index,
+                               const char *source) {
+  batch_error_t *errors =
+      realloc(report->errors, (report->failed + 1) * sizeof(batch_error_t));
+  if (!errors)
+    return;
+  report->errors = errors;
+
+  batch_error_t *error = &errors[report->failed++];
+  error->index = index;
+  error->code = error_get_last_code();
+  strncpy(error->source, source, MAX_PATH_LENGTH - 1);
+  error->source[MAX_PATH_LENGTH - 1] = '\0';
+  strncpy(error->message, error_get_last(), sizeof(error->message) - 1);
+  error->message[sizeof(error->message) - 1] = '\0';
+}
+
+static int batch_parse(struct json_object *json_obj,
+                       struct json_object **from_arr,
+                       struct json_object **to_obj) {
+  return json_object_object_get_ex(json_obj, "from", from_arr) &&
+         json_object_object_get_ex(json_obj, "to", to_obj) &&
+         json_object_get_type(*from_arr) == json_type_array &&
+         json_object_get_type(*to_obj) == json_type_string;
+}
+
+int fm_batch_do_json_objet(struct json_object *json_obj, batch_ctx_t *ctx,
+                           batch_report_t *report) {
   struct json_object *from_arr, *from_item_obj, *to_obj;
-  if (json_object_object_get_ex(json_obj, "from", &from_arr) &&
-      json_object_object_get_ex(json_obj, "to", &to_obj) &&
-      json_object_get_type(from_arr) == json_type_array &&
-      json_object_get_type(to_obj) == json_type_string) {
+  if (batch_parse(json_obj, &from_arr, &to_obj)) {
     int from_item_num = json_object_array_length(from_arr);
     for (int i = 0; i < from_item_num; i++) {
       // parse string[]
@@ -389,26 +1273,87 @@ int fm_batch_do_json_objet(struct json_object *json_obj) {
       if (json_object_get_type(from_item_obj) != json_type_string) {
         continue;
       }
-      fm_do_copy(json_object_get_string(from_item_obj),
-                 json_object_get_string(to_obj));
+      ctx->index = i;
+      if (ctx->journal && batch_journal_is_done(ctx->journal, i)) {
+        report->done++;
+        ctx->ops_done++;
+        continue;
+      }
+
+      const char *from = json_object_get_string(from_item_obj);
+      const char *to = json_object_get_string(to_obj);
+      char op[MAX_PATH_LENGTH];
+      snprintf(op, sizeof(op), "batch[%d] copy %s", i, from);
+      event_log_set_op(op);
+      error_clear();
+
+      int result = fm_do_copy(ctx, from, to);
+      if (result == FM_SUCCESS && ctx->journal)
+        result = batch_journal_done(ctx->journal, i);
+      if (result == FM_SUCCESS) {
+        report->done++;
+      } else {
+        if (error_get_last_code() == FM_SUCCESS)
+          error_log(FM_ERR_SYSTEM, "Copy failed");
+        batch_record_error(report, i, from);
+      }
+      ctx->ops_done++;
+      batch_report_progress(ctx, 0);
     }
+    event_log_set_op(NULL);
   }
-  return 0;
+
+  batch_report_progress(ctx, 1);
+  FM_LOG_INFO("batch finished: %zu done, %zu failed", report->done,
+              report->failed);
+  return report->failed ? report->errors[report->failed - 1].code
+                        : FM_SUCCESS;
 }
 
-int fm_batch_do_json(const char *json_file) {
+int fm_batch_do_json(const char *json_file, int resume,
+                     batch_report_t *report) {
+  memset(report, 0, sizeof(*report));
   char *json_str = file_string(json_file);
   if (!json_str)
     return FM_ERR_SYSTEM;
-  printf("json_str:%s\n", json_str);
+  FM_LOG_DEBUG("json_str:%s", json_str);
   struct json_object *parsed_json;
   parsed_json = json_tokener_parse(json_str);
-  free(json_str);
-  if (!parsed_json)
+  if (!parsed_json) {
+    free(json_str);
+    error_log(FM_ERR_SYSTEM, "Failed to parse batch file");
     return FM_ERR_SYSTEM;
-  printf("parsed json:%p\n", parsed_json);
+  }
+
+  batch_ctx_t ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  struct json_object *from_arr, *to_obj;
+  if (batch_parse(parsed_json, &from_arr, &to_obj))
+    ctx.op_count = json_object_array_length(from_arr);
+  clock_gettime(CLOCK_MONOTONIC, &ctx.started);
+
+  // The journal is tied to the exact manifest text, so an edited manifest
+  // is never resumed against stale progress
+  batch_journal_t journal;
+  int result = batch_journal_open(&journal, json_file, json_str, ctx.op_count,
+                                  resume);
+  free(json_str);
+  ctx.buffer = malloc(BATCH_COPY_BUFFER);
+  if (result == FM_SUCCESS && !ctx.buffer) {
+    error_log(FM_ERR_SYSTEM, "Memory allocation failed");
+    result = FM_ERR_SYSTEM;
+  }
+  if (result == FM_SUCCESS) {
+    ctx.journal = &journal;
+    result = fm_batch_do_json_objet(parsed_json, &ctx, report);
+    batch_journal_close(&journal, report->failed == 0);
+  } else if (journal.file) {
+    batch_journal_close(&journal, 0);
+  }
 
-  return fm_batch_do_json_objet(parsed_json);
+  free(ctx.buffer);
+  json_object_put(parsed_json);
+  return result;
 }
 
 void fm_cleanup(void) { db_close(); }
@@ -1,12 +1,18 @@
 #include "common.h"
+#include "catalog_snapshot.h"
 #include "db_manager.h"
 #include "file_manager.h"
 #include "error_handler.h"
+#include "event_log.h"
+#include <limits.h>
 
 static void print_usage() {
     printf("Usage: fm <command> [options]\n\n");
     printf("Commands:\n");
-    printf("  init <root_path>         Initialize file management system\n");
+    printf("  init [--hash <algo>]     Initialize file management system\n");
+    printf("       [--chunked|--no-chunked]\n");
+    printf("                           algo: sha256 (default), blake3, xxh3\n");
+    printf("                           --chunked: Merkle checksums for files >= 64 MiB\n");
     printf("  create <path> [size]     Create a new file with optional size\n");
     printf("  mkdir <path>             Create a new directory\n");
     printf("  copy <src> <dest>        Copy a file or directory\n");
@@ -14,7 +20,40 @@ static void print_usage() {
     printf("  delete <path>            Delete a file or directory\n");
     printf("  list <path>              List contents of a directory\n");
     printf("  info <path>              Show file/directory information\n");
-    printf("  batch <json>             Input a json file to do batch works\n");
+    printf("  batch <json> [--resume]  Input a json file to do batch works\n");
+    printf("  sync <src> <dest> [--delete]  Copy only new or changed files\n");
+    printf("  verify <path>            Rehash a file and report changed chunks\n");
+    printf("  snapshot export <file>   Write a memory-mappable catalog snapshot\n");
+    printf("  snapshot list <file> <path>  List a directory from a snapshot\n");
+    printf("  snapshot info <file> <path>  Show an entry from a snapshot\n");
+    printf("  snap <dir> <name> [--allow-copy]\n");
+    printf("                           Copy-on-write snapshot of a directory;\n");
+    printf("                           --allow-copy: copy data if it cannot be shared\n");
+    printf("  snap check [dir]         Report reflink/subvolume support\n");
+    printf("  snap list                List snapshots\n");
+    printf("  snap restore <name>      Roll a directory back to a snapshot\n");
+    printf("  snap drop <name>         Delete a snapshot\n");
+    printf("                           (dirsnap is an alias of snap)\n");
+    printf("  gc [days] [--archive] [--archive-days <n>] [--convert]\n");
+    printf("                           Purge tombstones older than days (default 30);\n");
+    printf("                           archived rows expire after n days (default 365);\n");
+    printf("                           --convert: one-time full VACUUM of an old catalog\n");
+    printf("\nEnvironment:\n");
+    printf("  FM_EVENT_LOG <file>      Event log (default: %s in the store root)\n",
+           FM_EVENT_LOG_FILE);
+    printf("  FM_LOG_LEVEL <level>     debug, info, warn or error\n");
+}
+
+// Non-negative day count; the whole argument must be a number
+static int parse_days(const char* text, int* days) {
+    char* end;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || value < 0 ||
+        value > INT_MAX)
+        return -1;
+    *days = (int)value;
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -25,6 +64,26 @@ int main(int argc, char* argv[]) {
 
     error_init();
 
+    const char* log_level = getenv("FM_LOG_LEVEL");
+    if (log_level) {
+        int level = event_log_level_from_name(log_level);
+        if (level < 0)
+            fprintf(stderr, "Ignoring unknown FM_LOG_LEVEL: %s\n", log_level);
+        else
+            event_log_set_level(level);
+    }
+
+    // Until the log is open (or if it cannot be), events go to stderr
+    char default_log_path[MAX_PATH_LENGTH];
+    snprintf(default_log_path, sizeof(default_log_path), "%s/%s",
+             fm_get_root_path(), FM_EVENT_LOG_FILE);
+    const char* event_log_path = getenv("FM_EVENT_LOG");
+    if (!event_log_path)
+        event_log_path = default_log_path;
+    if (event_log_open(event_log_path) != FM_SUCCESS)
+        fprintf(stderr, "Cannot open event log %s: %s\n", event_log_path,
+                strerror(errno));
+
     const char* command = argv[1];
     int result = FM_SUCCESS;
 
@@ -36,7 +95,24 @@ int main(int argc, char* argv[]) {
         //     printf("Error: init requires root path\n");
         //     return 1;
         // }
-        result = fm_init("/home/o/Public");
+        const char* checksum_algo = NULL;
+        int chunked = -1;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+                checksum_algo = argv[++i];
+            }
+            else if (strcmp(argv[i], "--chunked") == 0) {
+                chunked = 1;
+            }
+            else if (strcmp(argv[i], "--no-chunked") == 0) {
+                chunked = 0;
+            }
+            else {
+                print_usage();
+                return 1;
+            }
+        }
+        result = fm_init("/home/o/Public", checksum_algo, chunked);
     }
     else if (strcmp(command, "create") == 0) {
         if (argc < 3) {
@@ -105,12 +181,194 @@ int main(int argc, char* argv[]) {
             printf("Type: %s\n", info.type);
             printf("Size: %zu bytes\n", info.size);
             if (strcmp(info.type, FILE_TYPE_FILE) == 0) {
-                printf("Checksum: %s\n", info.checksum);
+                printf("Checksum: %s:%s\n",
+                       info.checksum_algo[0] ? info.checksum_algo : "sha256",
+                       info.checksum);
+            }
+        }
+    }
+    else if (strcmp(command, "sync") == 0) {
+        if (argc < 4) {
+            printf("Error: sync requires source and destination paths\n");
+            return 1;
+        }
+        int propagate_delete = argc > 4 && strcmp(argv[4], "--delete") == 0;
+        sync_stats_t stats;
+        result = fm_sync(argv[2], argv[3], propagate_delete, &stats);
+        if (result == FM_SUCCESS) {
+            printf("Scanned %zu files: %zu copied, %zu delta, %zu unchanged, "
+                   "%zu deleted\n",
+                   stats.files_scanned, stats.files_copied, stats.files_delta,
+                   stats.files_skipped, stats.files_deleted);
+            printf("Wrote %zu bytes, left %zu bytes unchanged\n",
+                   stats.bytes_literal, stats.bytes_matched);
+        }
+    }
+    else if (strcmp(command, "verify") == 0) {
+        if (argc != 3) {
+            printf("Error: verify requires path\n");
+            return 1;
+        }
+        size_t* bad = NULL;
+        size_t bad_count = 0;
+        result = fm_verify(argv[2], &bad, &bad_count);
+        if (result == FM_SUCCESS) {
+            if (bad_count == 0) {
+                printf("%s: OK\n", argv[2]);
+            } else {
+                printf("%s: %zu chunk(s) changed:", argv[2], bad_count);
+                for (size_t i = 0; i < bad_count; i++) {
+                    printf(" %zu", bad[i]);
+                }
+                printf("\n");
+            }
+            free(bad);
+            if (bad_count > 0) {
+                return 1;
+            }
+        }
+    }
+    else if (strcmp(command, "snapshot") == 0) {
+        if (argc < 4) {
+            printf("Error: snapshot requires a subcommand and file\n");
+            return 1;
+        }
+        if (strcmp(argv[2], "export") == 0) {
+            result = catalog_snapshot_export(argv[3]);
+        }
+        else if (argc == 5 && (strcmp(argv[2], "list") == 0 ||
+                               strcmp(argv[2], "info") == 0)) {
+            catalog_snapshot_t snap;
+            result = catalog_snapshot_open(argv[3], &snap);
+            if (result == FM_SUCCESS && strcmp(argv[2], "list") == 0) {
+                const snapshot_record_t* items;
+                size_t count = catalog_snapshot_list(&snap, argv[4], &items);
+                printf("Contents of %s:\n", argv[4]);
+                for (size_t i = 0; i < count; i++) {
+                    printf("%s [%s] %llu bytes\n",
+                           catalog_snapshot_string(&snap, items[i].name),
+                           items[i].type == SNAPSHOT_TYPE_DIRECTORY
+                               ? FILE_TYPE_DIRECTORY : FILE_TYPE_FILE,
+                           (unsigned long long)items[i].size);
+                }
+            }
+            else if (result == FM_SUCCESS) {
+                const snapshot_record_t* item =
+                    catalog_snapshot_lookup(&snap, argv[4]);
+                if (!item) {
+                    error_log(FM_ERR_NOT_FOUND, "Path not in snapshot");
+                    result = FM_ERR_NOT_FOUND;
+                }
+                else {
+                    printf("Name: %s\n", catalog_snapshot_string(&snap, item->name));
+                    printf("Path: %s\n", catalog_snapshot_string(&snap, item->path));
+                    printf("Type: %s\n", item->type == SNAPSHOT_TYPE_DIRECTORY
+                                             ? FILE_TYPE_DIRECTORY : FILE_TYPE_FILE);
+                    printf("Size: %llu bytes\n", (unsigned long long)item->size);
+                    if (item->type == SNAPSHOT_TYPE_FILE) {
+                        const char* algo =
+                            catalog_snapshot_string(&snap, item->checksum_algo);
+                        printf("Checksum: %s:%s\n", algo[0] ? algo : "sha256",
+                               catalog_snapshot_string(&snap, item->checksum));
+                    }
+                }
+            }
+            catalog_snapshot_close(&snap);
+        }
+        else {
+            printf("Unknown snapshot subcommand: %s\n", argv[2]);
+            return 1;
+        }
+    }
+    else if (strcmp(command, "snap") == 0 ||
+             strcmp(command, "dirsnap") == 0) {
+        if (argc == 3 && strcmp(argv[2], "list") == 0) {
+            dirsnap_list_t list;
+            result = fm_dirsnap_list(&list);
+            for (size_t i = 0; i < list.count; i++) {
+                char created[32];
+                strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S",
+                         gmtime(&list.items[i].created_at));
+                printf("%s  %s  [%s] %zu entries  %s\n", list.items[i].name,
+                       list.items[i].source, list.items[i].method,
+                       list.items[i].entries, created);
+            }
+            free(list.items);
+        }
+        else if (argc == 4 && strcmp(argv[2], "restore") == 0) {
+            result = fm_dirsnap_restore(argv[3]);
+        }
+        else if (argc == 4 && strcmp(argv[2], "drop") == 0) {
+            result = fm_dirsnap_drop(argv[3]);
+        }
+        else if ((argc == 3 || argc == 4) && strcmp(argv[2], "check") == 0) {
+            const char* method = NULL;
+            result = fm_dirsnap_check(argc == 4 ? argv[3] : "", &method);
+            if (method)
+                printf("Snapshots use: %s\n", method);
+        }
+        else if (argc == 4 || (argc == 5 && strcmp(argv[4], "--allow-copy") == 0)) {
+            result = fm_dirsnap_create(argv[2], argv[3], argc == 5);
+        }
+        else {
+            printf("Error: %s requires <dir> <name>, list, check, restore <name> or drop <name>\n",
+                   command);
+            return 1;
+        }
+    }
+    else if (strcmp(command, "gc") == 0) {
+        int retention_days = 30;
+        int archive = 0;
+        int archive_days = 365;
+        int convert = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--archive") == 0) {
+                archive = 1;
+            }
+            else if (strcmp(argv[i], "--convert") == 0) {
+                convert = 1;
+            }
+            else if (strcmp(argv[i], "--archive-days") == 0) {
+                if (i + 1 >= argc ||
+                    parse_days(argv[++i], &archive_days) != 0) {
+                    printf("Error: --archive-days requires a day count\n");
+                    print_usage();
+                    return 1;
+                }
             }
+            else if (parse_days(argv[i], &retention_days) != 0) {
+                // A typo must not turn into "purge everything"
+                printf("Error: invalid retention '%s'\n", argv[i]);
+                print_usage();
+                return 1;
+            }
+        }
+        size_t purged = 0, archive_purged = 0;
+        result = fm_gc(retention_days, archive, archive_days, convert,
+                       &purged, &archive_purged);
+        if (result == FM_SUCCESS) {
+            printf("Purged %zu tombstones%s, expired %zu archived rows\n",
+                   purged, archive ? " (archived)" : "", archive_purged);
         }
     }
-    else if (strcmp(command, "json") == 0) {
-        fm_batch_do_json(argv[2]);
+    else if (strcmp(command, "batch") == 0 || strcmp(command, "json") == 0) {
+        int resume = argc == 4 && strcmp(argv[3], "--resume") == 0;
+        if (argc != 3 && !resume) {
+            printf("Error: batch requires a batch file\n");
+            return 1;
+        }
+        batch_report_t report;
+        result = fm_batch_do_json(argv[2], resume, &report);
+        printf("Batch: %zu done, %zu failed\n", report.done, report.failed);
+        for (size_t i = 0; i < report.failed; i++) {
+            printf("  [%zu] %s: %s\n", report.errors[i].index,
+                   report.errors[i].source, report.errors[i].message);
+        }
+        free(report.errors);
+        // Failed entries are listed above; the last error may belong to
+        // an entry that ran (and cleared it) afterwards
+        if (report.failed > 0)
+            return 1;
     }
     else {
         printf("Unknown command: %s\n", command);